@@ -0,0 +1,136 @@
+// --- Coroutine Frame Benchmark -----------------------------------------------
+//
+// Written by Chris DeJong, GitHub @ magictrickdev
+//
+//      Measures the cost of creating, running and destroying coroutines whose
+//      frames come from global operator new versus sfa::coroutine_frame_allocator.
+//      Each case is run for a small frame and for a frame large enough to skip the
+//      size class thread cache. Several coroutines are kept alive at a time so the
+//      compiler cannot elide the frame allocation entirely. The cases are run
+//      interleaved several times over and the fastest run of each is reported, which
+//      keeps warm-up and scheduling noise out of the comparison.
+//
+// -----------------------------------------------------------------------------
+
+#define SFA_IMPLEMENTATION
+#include "../sfallocator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+
+#define SFA_BENCHMARK_ITERATIONS    (2000000)
+#define SFA_BENCHMARK_IN_FLIGHT     (16)
+#define SFA_BENCHMARK_REPEATS       (7)
+
+template <class Base>
+struct task
+{
+
+    struct promise_type : Base
+    {
+
+        int value = 0;
+
+        task                get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void                return_value(int result) { this->value = result; }
+        void                unhandled_exception() { std::terminate(); }
+
+    };
+
+    explicit task(std::coroutine_handle<promise_type> handle) : handle(handle) { }
+
+    std::coroutine_handle<promise_type> handle;
+
+};
+
+struct default_frames { };
+
+template <class Base> task<Base>
+small_frame(int seed)
+{
+
+    int accumulator = seed;
+    for (int index = 0; index < 4; ++index) accumulator += index * seed;
+    co_return accumulator;
+
+}
+
+template <class Base> task<Base>
+large_frame(int seed)
+{
+
+    // The buffer lives across a suspension point, so it is part of the frame.
+    volatile char buffer[2048];
+    buffer[seed & 2047] = (char)seed;
+    co_await std::suspend_never{};
+    co_return buffer[seed & 2047];
+
+}
+
+template <class Base, class Factory> static double
+run_churn(Factory factory)
+{
+
+    std::coroutine_handle<typename task<Base>::promise_type> in_flight[SFA_BENCHMARK_IN_FLIGHT] = {};
+    long long checksum = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < SFA_BENCHMARK_ITERATIONS; ++iteration)
+    {
+
+        int slot = iteration % SFA_BENCHMARK_IN_FLIGHT;
+        if (in_flight[slot])
+        {
+            in_flight[slot].resume();
+            checksum += in_flight[slot].promise().value;
+            in_flight[slot].destroy();
+        }
+
+        in_flight[slot] = factory(iteration).handle;
+
+    }
+
+    for (auto &handle : in_flight) if (handle) handle.destroy();
+    auto end = std::chrono::steady_clock::now();
+
+    if (checksum == 42) std::printf(" ");
+    return std::chrono::duration<double, std::nano>(end - begin).count() / SFA_BENCHMARK_ITERATIONS;
+
+}
+
+int
+main(int argc, char **argv)
+{
+
+    (void)argc;
+    (void)argv;
+
+    double small_default    = 1e9;
+    double small_sfa        = 1e9;
+    double large_default    = 1e9;
+    double large_sfa        = 1e9;
+    for (int repeat = 0; repeat < SFA_BENCHMARK_REPEATS; ++repeat)
+    {
+
+        small_default   = std::min(small_default, run_churn<default_frames>(small_frame<default_frames>));
+        small_sfa       = std::min(small_sfa, run_churn<sfa::coroutine_frame_allocator>(small_frame<sfa::coroutine_frame_allocator>));
+        large_default   = std::min(large_default, run_churn<default_frames>(large_frame<default_frames>));
+        large_sfa       = std::min(large_sfa, run_churn<sfa::coroutine_frame_allocator>(large_frame<sfa::coroutine_frame_allocator>));
+
+    }
+
+
+    std::printf("Coroutine frame churn, %d iterations, best of %d (ns per coroutine)\n",
+            SFA_BENCHMARK_ITERATIONS, SFA_BENCHMARK_REPEATS);
+    std::printf("    small frame   operator new: %8.2f   sfa: %8.2f\n", small_default, small_sfa);
+    std::printf("    large frame   operator new: %8.2f   sfa: %8.2f\n", large_default, large_sfa);
+
+    return 0;
+
+}
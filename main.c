@@ -1,12 +1,1049 @@
 #include <stdio.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#   include <sys/resource.h>
+#   include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#   include <pthread.h>
+#   include <sys/mman.h>
+#endif
+
+#define SFA_IMPLEMENTATION
 #include "sfallocator.h"
 
+// --- Test Harness ------------------------------------------------------------
+//
+// Each test is a function which checks a feature through the public API, failed
+// checks are reported as they happen and the run fails if any check failed.
+//
+
+static int test_failure_count = 0;
+
+#define TEST_CHECK(expr) do { if (!(expr)) { \
+    printf("    Failed: %s (%s:%d)\n", #expr, __FILE__, __LINE__); \
+    test_failure_count += 1; } } while (0)
+
+#define TEST_RUN(test) do { printf("%s\n", #test); test(); } while (0)
+
+static bool
+test_count_block(void *ptr, uint64_t size, void *user_data)
+{
+
+    (void)ptr;
+    (void)size;
+    *(uint64_t*)user_data += 1;
+    return true;
+
+}
+
+static uint64_t
+test_occupied_count(sfa_heap *heap)
+{
+
+    uint64_t block_count = 0;
+    sf_heap_walk(heap, test_count_block, &block_count);
+    return block_count;
+
+}
+
+// --- Tests -------------------------------------------------------------------
+
+static uint64_t test_buffer[SFA_KILOBYTES(256) / sizeof(uint64_t)];
+
+static bool
+test_is_in_buffer(void *ptr)
+{
+
+    return (uint8_t*)ptr >= (uint8_t*)test_buffer && (uint8_t*)ptr < (uint8_t*)test_buffer + sizeof(test_buffer);
+
+}
+
+static void
+test_init_with_buffer()
+{
+
+    // Must run before anything touches the default heap. Its first pool is the
+    // buffer, which is neither committed nor a reason to read the memory limit.
+    sfa_state *state = __sfa_get_state();
+    TEST_CHECK(sf_init_with_buffer(test_buffer, sizeof(test_buffer)));
+    TEST_CHECK(sf_init_with_buffer(test_buffer, sizeof(test_buffer)) == false);
+
+    void *small = sf_alloc(1000);
+    void *medium = sf_alloc(SFA_KILOBYTES(64));
+    TEST_CHECK(test_is_in_buffer(small) && test_is_in_buffer(medium));
+    TEST_CHECK(sf_heap_committed_size(NULL) == 0);
+    TEST_CHECK(state->memory_limit_probed == false);
+
+    // Outgrowing the buffer maps regular pools.
+    void *large = sf_alloc(SFA_KILOBYTES(512));
+    TEST_CHECK(large != NULL && test_is_in_buffer(large) == false);
+    TEST_CHECK(sf_heap_committed_size(NULL) > 0);
+    TEST_CHECK(state->memory_limit_probed);
+
+    sf_free(small);
+    sf_free(medium);
+    sf_free(large);
+
+}
+
+static void
+test_alloc_free()
+{
+
+    // Sizes across the thread cache, the pools and dedicated large pools.
+    uint64_t sizes[] = { 1, 24, 100, 1024, 4000, SFA_KILOBYTES(64), SFA_MEGABYTES(4) };
+    void *blocks[sizeof(sizes) / sizeof(sizes[0])];
+    for (uint64_t index = 0; index < sizeof(sizes) / sizeof(sizes[0]); ++index)
+    {
+
+        blocks[index] = sf_alloc(sizes[index]);
+        TEST_CHECK(blocks[index] != NULL);
+        TEST_CHECK((uint64_t)blocks[index] % SFA_ALLOCATION_ALIGNMENT_SIZE == 0);
+        TEST_CHECK(sf_usable_size(blocks[index]) >= sizes[index]);
+        memset(blocks[index], (int)index, sizes[index]);
+
+    }
+
+    for (uint64_t index = 0; index < sizeof(sizes) / sizeof(sizes[0]); ++index)
+    {
+        uint8_t *bytes = (uint8_t*)blocks[index];
+        TEST_CHECK(bytes[0] == (uint8_t)index && bytes[sizes[index] - 1] == (uint8_t)index);
+        sf_free(blocks[index]);
+    }
+
+    uint8_t *zeroed = (uint8_t*)sf_alloc_zeroed(SFA_KILOBYTES(16));
+    TEST_CHECK(zeroed != NULL && zeroed[0] == 0 && zeroed[SFA_KILOBYTES(16) - 1] == 0);
+    sf_free(zeroed);
+
+}
+
+static void
+test_coallesce()
+{
+
+    // Blocks are carved from the pool's tail in order, so freeing the middle three
+    // in any order must leave one free block that the left neighbor can grow over.
+    sfa_heap *heap = sf_heap_create(SFA_KILOBYTES(256));
+    TEST_CHECK(heap != NULL);
+
+    uint8_t *blocks[5];
+    for (int index = 0; index < 5; ++index) blocks[index] = (uint8_t*)sf_heap_alloc(heap, 256);
+    for (int index = 1; index < 5; ++index) TEST_CHECK(blocks[index] > blocks[index - 1]);
+    TEST_CHECK(test_occupied_count(heap) == 5);
+
+    uint64_t merged_size = (uint64_t)(blocks[4] - blocks[0]) - __sfa_allocation_descriptor_size();
+    sf_free(blocks[1]);
+    sf_free(blocks[3]);
+    sf_free(blocks[2]);
+    TEST_CHECK(test_occupied_count(heap) == 2);
+    TEST_CHECK(sf_try_expand(blocks[0], merged_size));
+    TEST_CHECK(sf_usable_size(blocks[0]) == merged_size);
+
+    sf_free(blocks[0]);
+    sf_free(blocks[4]);
+    TEST_CHECK(test_occupied_count(heap) == 0);
+
+    // With everything released the whole pool is one block again.
+    void *whole = sf_heap_alloc(heap, SFA_KILOBYTES(192));
+    TEST_CHECK(whole == blocks[0]);
+    sf_free(whole);
+    sf_heap_destroy(heap);
+
+}
+
+static void
+test_free_sized()
+{
+
+    // Sized frees of another heap's blocks must not end up in the default heap's
+    // thread cache, the block goes back to its own heap and coallesces there.
+    sfa_heap *heap = sf_heap_create(SFA_KILOBYTES(256));
+    void *block = sf_heap_alloc(heap, 48);
+    void *neighbor = sf_heap_alloc(heap, 48);
+    TEST_CHECK(block != NULL && neighbor != NULL);
+    sf_free_sized(block, 48);
+    TEST_CHECK(test_occupied_count(heap) == 1);
+
+    void *defaults[SFA_THREAD_CACHE_DEPTH];
+    for (int index = 0; index < SFA_THREAD_CACHE_DEPTH; ++index)
+    {
+        defaults[index] = sf_alloc(48);
+        TEST_CHECK(defaults[index] != block);
+    }
+
+    for (int index = 0; index < SFA_THREAD_CACHE_DEPTH; ++index) sf_free_sized(defaults[index], 48);
+    sf_free_sized(neighbor, 48);
+    TEST_CHECK(test_occupied_count(heap) == 0);
+
+    void *whole = sf_heap_alloc(heap, SFA_KILOBYTES(192));
+    TEST_CHECK(whole == block);
+    sf_free(whole);
+    sf_heap_destroy(heap);
+
+}
+
+static void
+test_alloc_at_least()
+{
+
+    // The reported size is the block's whole usable space, and all of it is writable.
+    uint64_t sizes[] = { 1, 100, 1000, SFA_KILOBYTES(3) + 7, SFA_KILOBYTES(100) };
+    for (int index = 0; index < (int)(sizeof(sizes) / sizeof(sizes[0])); ++index)
+    {
+
+        uint64_t actual_size = 0;
+        unsigned char *block = sf_alloc_at_least(sizes[index], &actual_size);
+        TEST_CHECK(block != NULL && actual_size >= sizes[index]);
+        TEST_CHECK(actual_size == sf_usable_size(block));
+        memset(block, 0xAB, actual_size);
+        TEST_CHECK(block[actual_size - 1] == 0xAB);
+        sf_free(block);
+
+    }
+
+    uint64_t actual_size = 1;
+    TEST_CHECK(sf_alloc_at_least(SFA_ALLOCATION_MAXIMUM_SIZE + 1, &actual_size) == NULL);
+    TEST_CHECK(actual_size == 0);
+
+}
+
+static void
+test_alloc_near()
+{
+
+    // Fill the first pool until the heap grows a second one.
+    sfa_heap *heap = sf_heap_create(SFA_KILOBYTES(256));
+    void *blocks[64];
+    int block_count = 0;
+    sfa_pool_descriptor *first_pool = NULL;
+    sfa_pool_descriptor *last_pool = NULL;
+    do
+    {
+        blocks[block_count] = sf_heap_alloc(heap, SFA_KILOBYTES(16));
+        last_pool = __sfa_get_descriptor(blocks[block_count])->parent_pool;
+        if (first_pool == NULL) first_pool = last_pool;
+        block_count += 1;
+    } while (last_pool == first_pool && block_count < 64);
+    TEST_CHECK(last_pool != first_pool);
+
+    // With a hole in the first pool, a hint in the second pool keeps the allocation
+    // there, while a hint in the first pool fills the hole.
+    sf_free(blocks[2]);
+    void *near_last = sf_alloc_near(blocks[block_count - 1], 1000);
+    TEST_CHECK(near_last != NULL && __sfa_get_descriptor(near_last)->parent_pool == last_pool);
+    blocks[2] = sf_alloc_near(blocks[0], 1000);
+    TEST_CHECK(blocks[2] != NULL && __sfa_get_descriptor(blocks[2])->parent_pool == first_pool);
+    sf_free(near_last);
+
+    for (int index = 0; index < block_count; ++index) sf_free(blocks[index]);
+    TEST_CHECK(test_occupied_count(heap) == 0);
+    sf_heap_destroy(heap);
+
+}
+
+static void
+test_huge_pages()
+{
+
+    // Every pool of a huge page heap starts on and spans whole huge pages, the
+    // initial one as well as those grown for oversized blocks.
+    sfa_heap *heap = sf_heap_create_ext(SFA_KILOBYTES(256), SFA_HEAP_HUGE_PAGES);
+    TEST_CHECK(heap != NULL);
+    void *small = sf_heap_alloc(heap, 64);
+    void *large = sf_heap_alloc(heap, SFA_MEGABYTES(3));
+    TEST_CHECK(small != NULL && large != NULL);
+
+    sfa_pool_descriptor *pools[2] = { __sfa_get_descriptor(small)->parent_pool,
+        __sfa_get_descriptor(large)->parent_pool };
+    TEST_CHECK(pools[0] != pools[1]);
+    for (int index = 0; index < 2; ++index)
+    {
+        TEST_CHECK((uint64_t)pools[index] % SFA_HUGE_PAGE_SIZE == 0);
+        TEST_CHECK(pools[index]->reserve_size % SFA_HUGE_PAGE_SIZE == 0);
+    }
+
+    TEST_CHECK(sf_heap_committed_size(heap) % SFA_HUGE_PAGE_SIZE == 0);
+    sf_free(small);
+    sf_free(large);
+    sf_heap_destroy(heap);
+
+}
+
+static void
+test_purge()
+{
+
+    // Blocks below the threshold stay committed until they are purged, and are only
+    // purged once.
+    sfa_heap *heap = sf_heap_create(SFA_MEGABYTES(4));
+    void *small = sf_heap_alloc(heap, SFA_KILOBYTES(512));
+    void *blocker = sf_heap_alloc(heap, 64);
+    TEST_CHECK(small != NULL && blocker != NULL);
+    memset(small, 0xAB, SFA_KILOBYTES(512));
+    sf_free(small);
+
+    uint64_t purged_size = sf_heap_purge(heap);
+    TEST_CHECK(purged_size > 0 && purged_size <= SFA_KILOBYTES(512));
+    TEST_CHECK(sf_heap_purge(heap) == 0);
+
+    // Blocks at or above the threshold are purged as they are freed.
+    void *large = sf_heap_alloc(heap, SFA_PURGE_THRESHOLD * 2);
+    TEST_CHECK(large != NULL);
+    memset(large, 0xAB, SFA_PURGE_THRESHOLD * 2);
+    sf_free(large);
+    TEST_CHECK(sf_heap_purge(heap) == 0);
+
+    sf_free(blocker);
+    sf_heap_destroy(heap);
+
+}
+
+#if !defined(_WIN32)
+static bool
+test_is_purged(sfa_heap *heap, void *ptr)
+{
+
+    __sfa_lock_acquire(&heap->lock);
+    bool is_purged = __sfa_get_descriptor(ptr)->flags.is_purged;
+    __sfa_lock_release(&heap->lock);
+    return is_purged;
+
+}
+
+static void
+test_decay()
+{
+
+    // The freed block is boxed in by occupied neighbors, so its descriptor stays put.
+    sfa_heap *heap = sf_heap_create(SFA_MEGABYTES(4));
+    void *front = sf_heap_alloc(heap, 64);
+    void *large = sf_heap_alloc(heap, SFA_MEGABYTES(2));
+    void *back = sf_heap_alloc(heap, 64);
+    TEST_CHECK(front != NULL && large != NULL && back != NULL);
+    memset(large, 0xAB, SFA_MEGABYTES(2));
+
+    // While decaying, large blocks are no longer purged on free but by the decay
+    // thread once they have been free for the decay time.
+    TEST_CHECK(sf_decay_start(200));
+    sf_free(large);
+    TEST_CHECK(test_is_purged(heap, large) == false);
+
+    for (int attempt = 0; attempt < 500 && test_is_purged(heap, large) == false; ++attempt)
+        usleep(10000);
+    TEST_CHECK(test_is_purged(heap, large));
+    TEST_CHECK(sf_heap_purge(heap) == 0);
+    sf_decay_stop();
+
+    sf_free(front);
+    sf_free(back);
+    sf_heap_destroy(heap);
+
+}
+#endif
+
+static void
+test_retained_pools()
+{
+
+    // An emptied pool is kept mapped and handed out again for the next growth, so
+    // the heap's commitment doesn't change.
+    sfa_heap *heap = sf_heap_create(SFA_KILOBYTES(256));
+    void *first = sf_heap_alloc(heap, SFA_KILOBYTES(512));
+    TEST_CHECK(first != NULL);
+    sfa_pool_descriptor *pool = __sfa_get_descriptor(first)->parent_pool;
+    TEST_CHECK(pool != heap->head_pool);
+    uint64_t committed_size = sf_heap_committed_size(heap);
+    sf_free(first);
+    TEST_CHECK(sf_heap_committed_size(heap) == committed_size);
+
+    void *second = sf_heap_alloc(heap, SFA_KILOBYTES(512));
+    TEST_CHECK(second != NULL && __sfa_get_descriptor(second)->parent_pool == pool);
+    TEST_CHECK(sf_heap_committed_size(heap) == committed_size);
+
+    // Purging gives retained pools back to the OS.
+    uint64_t reserve_size = pool->reserve_size;
+    sf_free(second);
+    TEST_CHECK(sf_heap_purge(heap) >= reserve_size);
+    TEST_CHECK(sf_heap_committed_size(heap) == committed_size - reserve_size);
+    sf_heap_destroy(heap);
+
+}
+
+#if defined(__linux__)
+static void
+test_prefault()
+{
+
+    // Every page of the initial reservation is resident before anything touches it.
+    sfa_heap *heap = sf_heap_create_ext(SFA_MEGABYTES(8), SFA_HEAP_PREFAULT);
+    TEST_CHECK(heap != NULL);
+    sfa_pool_descriptor *pool = heap->head_pool;
+    uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t page_count = pool->reserve_size / page_size;
+    TEST_CHECK(page_count >= SFA_MEGABYTES(8) / page_size);
+
+    unsigned char *residency = (unsigned char*)sf_alloc(page_count);
+    TEST_CHECK(mincore(pool, pool->reserve_size, residency) == 0);
+    uint64_t resident_count = 0;
+    for (uint64_t index = 0; index < page_count; ++index) resident_count += residency[index] & 1;
+    TEST_CHECK(resident_count == page_count);
+
+    sf_free(residency);
+    sf_heap_destroy(heap);
+
+}
+#endif
+
+static void
+test_resize_edges()
+{
+
+    sfa_heap *heap = sf_heap_create(SFA_KILOBYTES(256));
+    uint8_t *block = (uint8_t*)sf_heap_alloc(heap, 1024);
+    uint8_t *neighbor = (uint8_t*)sf_heap_alloc(heap, 256);
+    uint64_t usable_size = sf_usable_size(block);
+    memset(block, 0xAB, usable_size);
+
+    // Sizes at or beyond the block, including ones which would wrap when rounded,
+    // leave it untouched.
+    TEST_CHECK(sf_shrink(block, usable_size) == false);
+    TEST_CHECK(sf_shrink(block, usable_size + 1) == false);
+    TEST_CHECK(sf_shrink(block, UINT64_MAX) == false);
+    TEST_CHECK(sf_shrink(block, SFA_ALLOCATION_MAXIMUM_SIZE + 1) == false);
+    TEST_CHECK(sf_usable_size(block) == usable_size);
+
+    // Growing into an occupied neighbor fails, growing within the block succeeds.
+    TEST_CHECK(sf_try_expand(block, usable_size));
+    TEST_CHECK(sf_try_expand(block, usable_size + 1) == false);
+    TEST_CHECK(sf_try_expand(block, UINT64_MAX) == false);
+
+    // Shrinking to nothing keeps the minimum block, the released tail can then be
+    // grown back over without disturbing the contents.
+    TEST_CHECK(sf_shrink(block, 0));
+    TEST_CHECK(sf_usable_size(block) == SFA_ALLOCATION_MINIMUM_SIZE);
+    TEST_CHECK(sf_try_expand(block, usable_size));
+    TEST_CHECK(block[0] == 0xAB && block[SFA_ALLOCATION_MINIMUM_SIZE - 1] == 0xAB);
+
+    // A free right neighbor is absorbed, so the block can grow over it.
+    sf_free(neighbor);
+    TEST_CHECK(sf_try_expand(block, usable_size + 256));
+    TEST_CHECK(sf_shrink(block, 64));
+    TEST_CHECK(sf_usable_size(block) == 64);
+    sf_free(block);
+    sf_heap_destroy(heap);
+
+}
+
+static void
+test_group_alignment()
+{
+
+    uint64_t sizes[] = { 3, 100, 17, 4096, 1 };
+    uint64_t alignments[] = { 8, 64, 256, 4096, 32 };
+    void *parts[5];
+    uint8_t *group = (uint8_t*)sf_alloc_group(sizes, alignments, 5, parts);
+    TEST_CHECK(group != NULL && parts[0] == group);
+    for (int index = 0; index < 5; ++index)
+    {
+        TEST_CHECK((uint64_t)parts[index] % alignments[index] == 0);
+        if (index > 0) TEST_CHECK((uint8_t*)parts[index] >= (uint8_t*)parts[index - 1] + sizes[index - 1]);
+        memset(parts[index], index, sizes[index]);
+    }
+
+    TEST_CHECK((uint8_t*)parts[4] + sizes[4] <= group + sf_usable_size(group));
+    sf_free_group(group);
+
+    // Natural alignment without alignments, and every part NULL on failure.
+    group = (uint8_t*)sf_alloc_group(sizes, NULL, 5, parts);
+    for (int index = 0; index < 5; ++index)
+        TEST_CHECK((uint64_t)parts[index] % SFA_ALLOCATION_ALIGNMENT_SIZE == 0);
+    sf_free_group(group);
+
+    uint64_t huge_sizes[] = { 64, SFA_ALLOCATION_MAXIMUM_SIZE };
+    TEST_CHECK(sf_alloc_group(huge_sizes, NULL, 2, parts) == NULL);
+    TEST_CHECK(parts[0] == NULL && parts[1] == NULL);
+
+}
+
+static void
+test_lifetimes()
+{
+
+    // Every lifetime hint hands out ordinary blocks, which know their size and are
+    // released as usual.
+    uint64_t sizes[] = { 1, 17, 40, 3, 100 };
+    for (uint64_t lifetime = SFA_LIFETIME_SHORT; lifetime <= SFA_LIFETIME_PERMANENT; ++lifetime)
+    {
+        for (int index = 0; index < 5; ++index)
+        {
+            void *block = sf_alloc_hint(sizes[index], lifetime);
+            TEST_CHECK(block != NULL && (uint64_t)block % SFA_ALLOCATION_ALIGNMENT_SIZE == 0);
+            TEST_CHECK(sf_usable_size(block) >= sizes[index]);
+            sf_free(block);
+        }
+    }
+
+    // Packed permanent allocations don't have descriptors, but keep the alignment
+    // every other entry point gives.
+    uint8_t *previous = NULL;
+    for (int index = 0; index < 5; ++index)
+    {
+        uint8_t *block = (uint8_t*)sf_alloc_permanent(sizes[index]);
+        TEST_CHECK(block != NULL && (uint64_t)block % SFA_ALLOCATION_ALIGNMENT_SIZE == 0);
+        if (previous != NULL) TEST_CHECK(block > previous);
+        memset(block, index, sizes[index]);
+        previous = block;
+    }
+
+}
+
+#if !defined(_WIN32)
+static void
+test_locked_heap()
+{
+
+    // A locked heap either has its pools counted as locked, or fails and says why.
+    struct rlimit lock_limit;
+    TEST_CHECK(getrlimit(RLIMIT_MEMLOCK, &lock_limit) == 0);
+    TEST_CHECK(sf_lock_limit() == ((lock_limit.rlim_cur == RLIM_INFINITY) ? UINT64_MAX : lock_limit.rlim_cur));
+
+    uint64_t locked_size = sf_locked_size();
+    sfa_heap *heap = sf_heap_create_ext(SFA_KILOBYTES(64), SFA_HEAP_LOCKED);
+    if (heap == NULL)
+    {
+        TEST_CHECK(sf_lock_error() != 0);
+        return;
+    }
+
+    TEST_CHECK(sf_locked_size() >= locked_size + SFA_KILOBYTES(64));
+    sf_heap_destroy(heap);
+    TEST_CHECK(sf_locked_size() == locked_size);
+
+}
+#endif
+
+static void
+test_pressure_callback(sfa_heap *heap, uint64_t committed_size, void *user_data)
+{
+
+    (void)heap;
+    uint64_t *largest_committed = (uint64_t*)user_data;
+    if (committed_size > *largest_committed) *largest_committed = committed_size;
+
+}
+
+static void
+test_limits()
+{
+
+    sfa_heap *heap = sf_heap_create(SFA_KILOBYTES(256));
+    uint64_t initial_size = sf_heap_committed_size(heap);
+    uint64_t soft_limit = initial_size + SFA_MEGABYTES(1);
+    uint64_t hard_limit = initial_size + SFA_MEGABYTES(4);
+    uint64_t largest_committed = 0;
+    TEST_CHECK(initial_size > 0);
+    TEST_CHECK(sf_heap_add_pressure_callback(heap, test_pressure_callback, &largest_committed));
+    sf_heap_set_limits(heap, soft_limit, hard_limit);
+    TEST_CHECK(largest_committed == 0);
+
+    // Growing the heap crosses the soft limit first, which fires the callback, and
+    // then fails once another pool would pass the hard limit.
+    void *blocks[64];
+    int block_count = 0;
+    while (block_count < 64)
+    {
+        blocks[block_count] = sf_heap_alloc(heap, SFA_KILOBYTES(200));
+        if (blocks[block_count] == NULL) break;
+        block_count += 1;
+    }
+
+    TEST_CHECK(block_count > 0 && block_count < 64);
+    TEST_CHECK(largest_committed >= soft_limit);
+    TEST_CHECK(sf_heap_committed_size(heap) <= hard_limit);
+
+    // Removed callbacks no longer fire, raising the limit lets the heap grow again.
+    sf_heap_remove_pressure_callback(heap, test_pressure_callback, &largest_committed);
+    largest_committed = 0;
+    sf_heap_set_limits(heap, soft_limit, 0);
+    void *unlimited = sf_heap_alloc(heap, SFA_KILOBYTES(200));
+    TEST_CHECK(unlimited != NULL);
+    TEST_CHECK(largest_committed == 0);
+
+    sf_free(unlimited);
+    for (int index = 0; index < block_count; ++index) sf_free(blocks[index]);
+    sf_heap_destroy(heap);
+
+}
+
+static void
+test_handle_compaction()
+{
+
+    // Every other handle is freed and one in the middle is kept locked, the blocks
+    // in front of it slide into the holes and so do the ones behind it.
+    sfa_heap *heap = sf_heap_create(SFA_KILOBYTES(256));
+    sfa_handle handles[32];
+    for (int index = 0; index < 32; ++index)
+    {
+        handles[index] = sf_handle_alloc(heap, SFA_KILOBYTES(1));
+        TEST_CHECK(handles[index] != 0);
+        memset(sf_handle_lock(handles[index]), index + 1, SFA_KILOBYTES(1));
+        sf_handle_unlock(handles[index]);
+    }
+
+    uint8_t *first = (uint8_t*)sf_handle_lock(handles[0]);
+    uint64_t block_stride = (uint64_t)((uint8_t*)sf_handle_lock(handles[1]) - first);
+    sf_handle_unlock(handles[0]);
+    sf_handle_unlock(handles[1]);
+
+    for (int index = 0; index < 32; index += 2) sf_handle_free(handles[index]);
+    uint8_t *pinned = (uint8_t*)sf_handle_lock(handles[15]);
+    uint64_t block_size = sf_usable_size(pinned);
+
+    // Without any budget, each step moves at most one block and the next picks up
+    // where it stopped.
+    uint64_t moved_size = 0;
+    for (int step = 0; step < 256; ++step)
+    {
+        uint64_t step_size = sf_heap_compact(heap, 0);
+        TEST_CHECK(step_size <= block_size);
+        moved_size += step_size;
+    }
+
+    TEST_CHECK(moved_size == 15 * block_size);
+    TEST_CHECK(sf_heap_compact(heap, 1000000) == 0);
+    TEST_CHECK(sf_handle_lock(handles[15]) == pinned);
+    sf_handle_unlock(handles[15]);
+
+    // The remaining blocks are packed together on either side of the pinned one, so
+    // the holes in front of it merged into a single free block.
+    for (int index = 1; index < 32; index += 2)
+    {
+
+        uint8_t *bytes = (uint8_t*)sf_handle_lock(handles[index]);
+        uint8_t *packed = (index < 15) ? first + (index / 2) * block_stride :
+            pinned + ((index - 15) / 2) * block_stride;
+        TEST_CHECK(bytes == packed);
+
+        bool is_preserved = true;
+        for (uint64_t offset = 0; offset < SFA_KILOBYTES(1); ++offset)
+            is_preserved = is_preserved && (bytes[offset] == (uint8_t)(index + 1));
+        TEST_CHECK(is_preserved);
+        sf_handle_unlock(handles[index]);
+
+    }
+
+    sf_handle_unlock(handles[15]);
+    for (int index = 1; index < 32; index += 2) sf_handle_free(handles[index]);
+    sf_heap_destroy(heap);
+
+    // Destroying a heap releases the handles still pointing into it, so their table
+    // entries are reused with a new generation.
+    heap = sf_heap_create(SFA_KILOBYTES(256));
+    sfa_handle orphan = sf_handle_alloc(heap, SFA_KILOBYTES(1));
+    sf_heap_destroy(heap);
+    sfa_handle reused = sf_handle_alloc(NULL, SFA_KILOBYTES(1));
+    TEST_CHECK(orphan != 0 && reused != 0 && reused != orphan);
+    TEST_CHECK((reused & UINT32_MAX) == (orphan & UINT32_MAX));
+    sf_handle_free(reused);
+
+}
+
+static void
+test_pressure_monitor()
+{
+
+    // Kernels without PSI, or which refuse the trigger, never start the monitor.
+    // Once started, stopping joins the thread so that it may be started again.
+    if (sf_pressure_monitor_start(100000, 2000000) == false) return;
+    TEST_CHECK(sf_pressure_monitor_start(100000, 2000000));
+    sf_pressure_monitor_stop();
+    TEST_CHECK(sf_pressure_monitor_start(100000, 2000000));
+    sf_pressure_monitor_stop();
+    sf_pressure_monitor_stop();
+
+}
+
+#if defined(__linux__)
+static void
+test_memory_limit()
+{
+
+    // Files which don't fit the buffer are unreadable rather than cut short.
+    char small[4];
+    char large[4096];
+    uint64_t length = __sfa_read_file("/proc/self/cgroup", large, sizeof(large));
+    TEST_CHECK(length > 0 && large[length] == '\0');
+    if (length >= sizeof(small)) TEST_CHECK(__sfa_read_file("/proc/self/cgroup", small, sizeof(small)) == 0);
+    TEST_CHECK(__sfa_read_file("/proc/self/no_such_file", large, sizeof(large)) == 0);
+
+    // Heaps in a memory limited cgroup retain less.
+    uint64_t memory_limit = __sfa_memory_limit();
+    uint64_t retained_limit = SFA_RETAINED_POOLS_MAXIMUM_SIZE;
+    if (memory_limit > 0 && memory_limit / 32 < retained_limit) retained_limit = memory_limit / 32;
+    sfa_heap *heap = sf_heap_create(SFA_KILOBYTES(256));
+    TEST_CHECK(heap->memory_limit_probed && heap->retained_limit == retained_limit);
+    sf_heap_destroy(heap);
+
+}
+#endif
+
+#if !defined(_WIN32)
+static void
+test_shared_heap()
+{
+
+    // A second mapping of the same region sits at another address, objects are
+    // found in it through their offsets.
+    sfa_shared_heap *heap = sf_shared_heap_create(NULL, SFA_MEGABYTES(1));
+    TEST_CHECK(heap != NULL);
+    if (heap == NULL) return;
+
+    sfa_shared_heap *mirror = sf_shared_heap_open_fd(dup(sf_shared_heap_fd(heap)));
+    TEST_CHECK(mirror != NULL);
+    if (mirror == NULL) return;
+
+    uint64_t offsets[16];
+    for (int index = 0; index < 16; ++index)
+    {
+
+        uint8_t *block = (uint8_t*)sf_shared_heap_alloc(heap, 100 + index * 50);
+        TEST_CHECK(block != NULL);
+        memset(block, index + 1, 100 + index * 50);
+        offsets[index] = sf_shared_heap_offset(heap, block);
+        TEST_CHECK(offsets[index] != 0);
+        TEST_CHECK(sf_shared_heap_pointer(heap, offsets[index]) == block);
+
+    }
+
+    TEST_CHECK(sf_shared_heap_offset(heap, NULL) == 0 && sf_shared_heap_pointer(heap, 0) == NULL);
+    for (int index = 0; index < 16; ++index)
+    {
+        uint8_t *mirrored = (uint8_t*)sf_shared_heap_pointer(mirror, offsets[index]);
+        TEST_CHECK(mirrored != sf_shared_heap_pointer(heap, offsets[index]));
+        TEST_CHECK(mirrored[0] == index + 1 && mirrored[100 + index * 50 - 1] == index + 1);
+        TEST_CHECK(sf_shared_heap_offset(mirror, mirrored) == offsets[index]);
+    }
+
+    // Blocks freed through either mapping coallesce back into the whole region.
+    for (int index = 0; index < 16; ++index)
+    {
+        sfa_shared_heap *owner = (index % 2) ? mirror : heap;
+        sf_shared_heap_free(owner, sf_shared_heap_pointer(owner, offsets[index]));
+    }
+
+    void *whole = sf_shared_heap_alloc(heap, SFA_KILOBYTES(960));
+    TEST_CHECK(whole != NULL);
+    sf_shared_heap_free(heap, whole);
+    sf_shared_heap_close(mirror);
+    sf_shared_heap_close(heap);
+
+}
+#endif
+
+#if !defined(_WIN32)
+typedef struct test_file_node
+{
+
+    uint64_t next_offset;
+    uint64_t value;
+
+} test_file_node;
+
+static void
+test_file_heap()
+{
+
+    // A list linked through offsets is saved with the heap's image.
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/sfalloc_test_%d.heap", (int)getpid());
+    sfa_shared_heap *heap = sf_shared_heap_create_file(path, SFA_MEGABYTES(1));
+    TEST_CHECK(heap != NULL);
+    if (heap == NULL) return;
+
+    uint64_t offsets[8];
+    uint64_t next_offset = 0;
+    for (int index = 7; index >= 0; --index)
+    {
+        test_file_node *node = (test_file_node*)sf_shared_heap_alloc(heap, sizeof(test_file_node));
+        node->next_offset = next_offset;
+        node->value = (uint64_t)index * 1000;
+        offsets[index] = next_offset = sf_shared_heap_offset(heap, node);
+    }
+
+    sf_shared_heap_set_root(heap, sf_shared_heap_pointer(heap, offsets[0]));
+    TEST_CHECK(sf_shared_heap_save(heap));
+    sf_shared_heap_close(heap);
+
+    // Reopened, the root and every offset lead to the same nodes, and the free list
+    // carries on from where it was.
+    heap = sf_shared_heap_open_file(path);
+    TEST_CHECK(heap != NULL);
+    if (heap == NULL) { unlink(path); return; }
+
+    test_file_node *node = (test_file_node*)sf_shared_heap_root(heap);
+    TEST_CHECK(node != NULL && sf_shared_heap_offset(heap, node) == offsets[0]);
+    for (int index = 0; index < 8 && node != NULL; ++index)
+    {
+        TEST_CHECK(sf_shared_heap_offset(heap, node) == offsets[index]);
+        TEST_CHECK(node->value == (uint64_t)index * 1000);
+        node = (test_file_node*)sf_shared_heap_pointer(heap, node->next_offset);
+    }
+
+    TEST_CHECK(node == NULL);
+    void *fresh = sf_shared_heap_alloc(heap, sizeof(test_file_node));
+    for (int index = 0; index < 8; ++index) TEST_CHECK(sf_shared_heap_offset(heap, fresh) != offsets[index]);
+    sf_shared_heap_free(heap, fresh);
+
+    for (int index = 0; index < 8; ++index) sf_shared_heap_free(heap, sf_shared_heap_pointer(heap, offsets[index]));
+    sf_shared_heap_close(heap);
+    unlink(path);
+
+}
+#endif
+
+#if !defined(_WIN32)
+static bool
+test_report_block(void *ptr, uint64_t size, void *user_data)
+{
+
+    (void)ptr;
+    (void)size;
+    char byte = 1;
+    return write(*(int*)user_data, &byte, 1) == 1;
+
+}
+
+static bool
+test_stop_walk(void *ptr, uint64_t size, void *user_data)
+{
+
+    (void)ptr;
+    (void)size;
+    (void)user_data;
+    return false;
+
+}
+
+static void
+test_snapshot()
+{
+
+    sfa_heap *heap = sf_heap_create(SFA_KILOBYTES(256));
+    void *blocks[10];
+    for (int index = 0; index < 10; ++index) blocks[index] = sf_heap_alloc(heap, 64 + index * 16);
+
+    // The child reports one byte per live block through the pipe, and walks the
+    // heap as it was at the fork while the parent frees half of it.
+    int pipe_fds[2];
+    TEST_CHECK(pipe(pipe_fds) == 0);
+    int64_t snapshot = sf_heap_snapshot(heap, test_report_block, &pipe_fds[1]);
+    close(pipe_fds[1]);
+    TEST_CHECK(snapshot > 0);
+    for (int index = 0; index < 10; index += 2) sf_free(blocks[index]);
+
+    uint64_t reported_count = 0;
+    char reported[16];
+    ssize_t read_size = 0;
+    while ((read_size = read(pipe_fds[0], reported, sizeof(reported))) > 0) reported_count += (uint64_t)read_size;
+    close(pipe_fds[0]);
+
+    TEST_CHECK(sf_snapshot_wait(snapshot));
+    TEST_CHECK(reported_count == 10);
+    TEST_CHECK(test_occupied_count(heap) == 5);
+
+    // A walk stopped by the callback is reported as a failed snapshot.
+    TEST_CHECK(sf_snapshot_wait(sf_heap_snapshot(heap, test_stop_walk, NULL)) == false);
+
+    for (int index = 1; index < 10; index += 2) sf_free(blocks[index]);
+    sf_heap_destroy(heap);
+
+}
+#endif
+
+#if defined(__linux__)
+#define TEST_MESH_CLASS         3
+#define TEST_MESH_SPAN_COUNT    1024
+
+typedef struct test_mesh_writer
+{
+
+    uint64_t  **blocks;
+    uint64_t    block_count;
+    uint64_t    pass_count;
+    uint64_t    mismatch_count;
+    int         is_stopped;
+
+} test_mesh_writer;
+
+static uint64_t
+test_mesh_fill(uint64_t **blocks)
+{
+
+    // Blocks are handed out from the lowest free slot of a span and each span fills
+    // up before the next is made, so block i sits at slot i % object_count of span
+    // i / object_count. Every other slot is freed, offset by one in every other span,
+    // which leaves neighbouring spans complementary.
+    uint64_t object_count = (uint64_t)sysconf(_SC_PAGESIZE) / SFA_SIZE_CLASS_SIZE(TEST_MESH_CLASS);
+    uint64_t live_count = 0;
+    for (uint64_t index = 0; index < TEST_MESH_SPAN_COUNT * object_count; ++index)
+    {
+        blocks[index] = (uint64_t*)sf_mesh_alloc(TEST_MESH_CLASS);
+        TEST_CHECK(blocks[index] != NULL);
+    }
+
+    for (uint64_t index = 0; index < TEST_MESH_SPAN_COUNT * object_count; ++index)
+    {
+
+        uint64_t span_index = index / object_count;
+        if ((index + span_index) % 2 == 0)
+        {
+            blocks[live_count] = blocks[index];
+            live_count += 1;
+            continue;
+        }
+
+        sf_mesh_free(blocks[index]);
+
+    }
+
+    return live_count;
+
+}
+
+static void*
+test_mesh_write(void *user_data)
+{
+
+    // Every pass checks that each block still holds the previous pass, a store lost
+    // to meshing shows up on the following pass.
+    test_mesh_writer *writer = (test_mesh_writer*)user_data;
+    while (__atomic_load_n(&writer->is_stopped, __ATOMIC_ACQUIRE) == 0)
+    {
+
+        for (uint64_t index = 0; index < writer->block_count; ++index)
+        {
+            if (writer->blocks[index][0] != writer->pass_count) writer->mismatch_count += 1;
+            writer->blocks[index][0] = writer->pass_count + 1;
+        }
+
+        __atomic_store_n(&writer->pass_count, writer->pass_count + 1, __ATOMIC_RELEASE);
+
+    }
+
+    return NULL;
+
+}
+
+static void
+test_mesh()
+{
+
+    static uint64_t *blocks[SFA_KILOBYTES(64)];
+    uint64_t block_size = SFA_SIZE_CLASS_SIZE(TEST_MESH_CLASS);
+    uint64_t live_count = test_mesh_fill(blocks);
+    for (uint64_t index = 0; index < live_count; ++index)
+        memset(blocks[index], (int)(index % 251) + 1, block_size);
+
+    // Snapshots can't see meshed blocks, so they are refused while any are live.
+    TEST_CHECK(sf_heap_snapshot(NULL, test_count_block, NULL) == -1);
+
+    uint64_t meshed_size = sf_mesh();
+    TEST_CHECK(meshed_size >= (TEST_MESH_SPAN_COUNT / 2) * (uint64_t)sysconf(_SC_PAGESIZE));
+
+    for (uint64_t index = 0; index < live_count; ++index)
+    {
+
+        uint8_t *bytes = (uint8_t*)blocks[index];
+        bool is_preserved = true;
+        for (uint64_t offset = 0; offset < block_size; ++offset)
+            is_preserved = is_preserved && (bytes[offset] == (uint8_t)(index % 251) + 1);
+        TEST_CHECK(is_preserved);
+
+    }
+
+    for (uint64_t index = 0; index < live_count; ++index)
+        sf_mesh_free(blocks[index]);
+
+    // Further rounds mesh while another thread keeps writing to every block, the
+    // window for a lost store is short so it takes a few rounds to hit reliably.
+    for (int round = 0; round < 4; ++round)
+    {
+
+        test_mesh_writer writer;
+        memset(&writer, 0, sizeof(writer));
+        writer.blocks = blocks;
+        writer.block_count = test_mesh_fill(blocks);
+        for (uint64_t index = 0; index < writer.block_count; ++index)
+            blocks[index][0] = 0;
+
+        pthread_t writer_thread;
+        TEST_CHECK(pthread_create(&writer_thread, NULL, test_mesh_write, &writer) == 0);
+        while (__atomic_load_n(&writer.pass_count, __ATOMIC_ACQUIRE) < 2) sched_yield();
+        TEST_CHECK(sf_mesh() > 0);
+        uint64_t pass_count = __atomic_load_n(&writer.pass_count, __ATOMIC_ACQUIRE);
+        while (__atomic_load_n(&writer.pass_count, __ATOMIC_ACQUIRE) < pass_count + 2) sched_yield();
+        __atomic_store_n(&writer.is_stopped, 1, __ATOMIC_RELEASE);
+        pthread_join(writer_thread, NULL);
+        TEST_CHECK(writer.mismatch_count == 0);
+
+        for (uint64_t index = 0; index < writer.block_count; ++index)
+            sf_mesh_free(blocks[index]);
+
+    }
+
+}
+#endif
+
 int
 main(int argc, char ** argv)
 {
 
+    (void)argc;
+    (void)argv;
+
     printf("SFAllocator Test Suite Version 1.0A\n");
 
-    return 0;
+    TEST_RUN(test_init_with_buffer);
+    TEST_RUN(test_alloc_free);
+    TEST_RUN(test_coallesce);
+    TEST_RUN(test_free_sized);
+    TEST_RUN(test_alloc_at_least);
+    TEST_RUN(test_alloc_near);
+    TEST_RUN(test_huge_pages);
+    TEST_RUN(test_purge);
+    TEST_RUN(test_retained_pools);
+#if defined(__linux__)
+    TEST_RUN(test_prefault);
+#endif
+#if !defined(_WIN32)
+    TEST_RUN(test_decay);
+#endif
+    TEST_RUN(test_resize_edges);
+    TEST_RUN(test_group_alignment);
+    TEST_RUN(test_lifetimes);
+    TEST_RUN(test_limits);
+#if !defined(_WIN32)
+    TEST_RUN(test_locked_heap);
+#endif
+    TEST_RUN(test_pressure_monitor);
+#if defined(__linux__)
+    TEST_RUN(test_memory_limit);
+#endif
+    TEST_RUN(test_handle_compaction);
+#if !defined(_WIN32)
+    TEST_RUN(test_shared_heap);
+    TEST_RUN(test_file_heap);
+    TEST_RUN(test_snapshot);
+#endif
+#if defined(__linux__)
+    TEST_RUN(test_mesh);
+#endif
+
+    if (test_failure_count > 0) printf("%d check(s) failed.\n", test_failure_count);
+    return (test_failure_count > 0) ? 1 : 0;
 
 }
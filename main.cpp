@@ -0,0 +1,255 @@
+#include <cstdio>
+#include <list>
+#include <memory_resource>
+#include <stdexcept>
+#include <vector>
+
+#define SFA_IMPLEMENTATION
+#include "sfallocator.hpp"
+
+// --- Test Harness ------------------------------------------------------------
+//
+// The C++ adapters are tested separately from main.c, with the same harness. Each
+// test checks a feature through the adapters' public interface.
+//
+
+static int test_failure_count = 0;
+
+#define TEST_CHECK(expr) do { if (!(expr)) { \
+    std::printf("    Failed: %s (%s:%d)\n", #expr, __FILE__, __LINE__); \
+    test_failure_count += 1; } } while (0)
+
+#define TEST_RUN(test) do { std::printf("%s\n", #test); test(); } while (0)
+
+static bool
+test_count_block(void *ptr, uint64_t size, void *user_data)
+{
+
+    (void)ptr;
+    (void)size;
+    *(uint64_t*)user_data += 1;
+    return true;
+
+}
+
+static uint64_t
+test_occupied_count(sfa_heap *heap)
+{
+
+    uint64_t block_count = 0;
+    sf_heap_walk(heap, test_count_block, &block_count);
+    return block_count;
+
+}
+
+// Counts its live instances and, when armed, throws from the copy constructor after
+// the given number of copies. It has no move constructor, so relocating copies.
+struct test_element
+{
+
+    static int live_count;
+    static int copies_until_throw;
+    int value;
+
+    test_element(int value) : value(value) { live_count += 1; }
+    test_element(const test_element &other) : value(other.value)
+    {
+        if (copies_until_throw > 0 && --copies_until_throw == 0)
+            throw std::runtime_error("test_element copy failed.");
+        live_count += 1;
+    }
+
+   ~test_element() { live_count -= 1; }
+
+};
+
+int test_element::live_count = 0;
+int test_element::copies_until_throw = 0;
+
+// --- Tests -------------------------------------------------------------------
+
+static bool
+test_is_from_heap(const void *ptr, sfa_heap *heap)
+{
+
+    return __sfa_get_descriptor((void*)ptr)->parent_pool->parent_state == heap;
+
+}
+
+static void
+test_memory_resource()
+{
+
+    // Standard containers allocate from the resource's own heap, over-aligned
+    // requests included, and release everything again.
+    sfa::memory_resource resource(SFA_MEGABYTES(1));
+    {
+
+        std::pmr::vector<int> values(&resource);
+        for (int index = 0; index < 1000; ++index) values.push_back(index);
+        TEST_CHECK(test_is_from_heap(values.data(), resource.heap()));
+
+        void *aligned = resource.allocate(100, 256);
+        TEST_CHECK((uint64_t)aligned % 256 == 0 && test_is_from_heap(aligned, resource.heap()));
+        resource.deallocate(aligned, 100, 256);
+
+    }
+
+    TEST_CHECK(test_occupied_count(resource.heap()) == 0);
+
+    // Resources on the same heap can free each other's memory, others can't.
+    sfa::memory_resource shared(resource.heap());
+    sfa::memory_resource fallback;
+    TEST_CHECK(resource.is_equal(shared) && !resource.is_equal(fallback));
+
+}
+
+static void
+test_allocator()
+{
+
+    // Rebound copies keep the heap, so node based containers allocate from it too.
+    sfa_heap *heap = sf_heap_create(SFA_KILOBYTES(256));
+    sfa::allocator<int> allocator(heap);
+    {
+
+        std::vector<int, sfa::allocator<int>> values(allocator);
+        std::list<int, sfa::allocator<int>> nodes(allocator);
+        for (int index = 0; index < 100; ++index)
+        {
+            values.push_back(index);
+            nodes.push_back(index);
+        }
+
+        TEST_CHECK(test_is_from_heap(values.data(), heap));
+        TEST_CHECK(test_occupied_count(heap) == 101);
+        TEST_CHECK(nodes.get_allocator() == allocator);
+        TEST_CHECK(sfa::allocator<double>(allocator) == allocator);
+        TEST_CHECK(sfa::allocator<int>() != allocator);
+
+    }
+
+    TEST_CHECK(test_occupied_count(heap) == 0);
+    sf_heap_destroy(heap);
+
+    // The default heap's allocator frees through the sized path as it grows.
+    std::vector<int, sfa::allocator<int>> defaults;
+    for (int index = 0; index < 1000; ++index) defaults.push_back(index);
+    TEST_CHECK(test_is_from_heap(defaults.data(), __sfa_get_state()));
+    TEST_CHECK(defaults.front() == 0 && defaults.back() == 999);
+
+}
+
+static void
+test_fixed_size()
+{
+
+    static_assert(sfa::is_size_class_cached<48>, "48 bytes should be cached.");
+    static_assert(!sfa::is_size_class_cached<4096>, "4 KiB should not be cached.");
+    static_assert(!sfa::is_size_class_cached<64, 256>, "Over-aligned sizes should not be cached.");
+    static_assert(sfa::size_class_table[sfa::size_class_of<48>] >= 48, "Size class too small.");
+
+    // Cached sizes go through the thread cache, so a freed block comes straight back.
+    void *cached = sfa::alloc_fixed<48>();
+    TEST_CHECK(cached != NULL && (uint64_t)cached % SFA_ALLOCATION_ALIGNMENT_SIZE == 0);
+    TEST_CHECK(sf_usable_size(cached) >= 48);
+    sfa::free_fixed<48>(cached);
+    void *recycled = sfa::alloc_fixed<48>();
+    TEST_CHECK(recycled == cached);
+    sfa::free_fixed<48>(recycled);
+
+    // Everything else is forwarded to the regular entry points.
+    void *large = sfa::alloc_fixed<4096>();
+    TEST_CHECK(large != NULL && sf_usable_size(large) >= 4096);
+    sfa::free_fixed<4096>(large);
+
+    void *aligned = sfa::alloc_fixed<64, 256>();
+    TEST_CHECK(aligned != NULL && (uint64_t)aligned % 256 == 0);
+    sfa::free_fixed<64, 256>(aligned);
+
+    // The object pool constructs and destroys in its fixed size blocks.
+    sfa::object_pool<test_element> pool;
+    test_element *element = pool.create(7);
+    TEST_CHECK(element->value == 7 && test_element::live_count == 1);
+    pool.destroy(element);
+    TEST_CHECK(test_element::live_count == 0);
+    TEST_CHECK(pool.create(8) == element);
+    pool.destroy(element);
+
+}
+
+static void
+test_vector()
+{
+
+    // The vector's block sits in front of the pool's tail, so it grows in place.
+    sfa_heap *heap = sf_heap_create(SFA_KILOBYTES(256));
+    {
+
+        sfa::vector<test_element> values(heap);
+        for (int index = 0; index < 8; ++index) values.emplace_back(index);
+        test_element *in_place = values.data();
+        values.reserve(256);
+        TEST_CHECK(values.data() == in_place && values.capacity() >= 256);
+
+        // Once a neighbor blocks it, growing relocates every element.
+        void *neighbor = sf_heap_alloc(heap, 16);
+        values.reserve(values.capacity() + 1);
+        TEST_CHECK(values.data() != in_place);
+        TEST_CHECK(test_element::live_count == 8);
+        for (int index = 0; index < 8; ++index) TEST_CHECK(values[index].value == index);
+
+        // A copy throwing partway through leaves the vector as it was, and the
+        // block it was relocating into goes back to the heap.
+        void *blocker = sf_heap_alloc(heap, 16);
+        test_element *relocated = values.data();
+        uint64_t occupied_count = test_occupied_count(heap);
+        test_element::copies_until_throw = 4;
+        bool has_thrown = false;
+        try { values.reserve(values.capacity() + 1); }
+        catch (const std::runtime_error&) { has_thrown = true; }
+        test_element::copies_until_throw = 0;
+
+        TEST_CHECK(has_thrown);
+        TEST_CHECK(values.data() == relocated && values.size() == 8);
+        TEST_CHECK(test_element::live_count == 8);
+        TEST_CHECK(test_occupied_count(heap) == occupied_count);
+        for (int index = 0; index < 8; ++index) TEST_CHECK(values[index].value == index);
+
+        // Shrinking trims the block in place.
+        uint64_t capacity = values.capacity();
+        while (values.size() > 2) values.pop_back();
+        values.shrink_to_fit();
+        TEST_CHECK(values.data() == relocated && values.capacity() < capacity);
+        TEST_CHECK(values[0].value == 0 && values[1].value == 1);
+        TEST_CHECK(test_element::live_count == 2);
+
+        sf_free(neighbor);
+        sf_free(blocker);
+
+    }
+
+    TEST_CHECK(test_element::live_count == 0);
+    TEST_CHECK(test_occupied_count(heap) == 0);
+    sf_heap_destroy(heap);
+
+}
+
+int
+main(int argc, char ** argv)
+{
+
+    (void)argc;
+    (void)argv;
+
+    std::printf("SFAllocator C++ Test Suite Version 1.0A\n");
+
+    TEST_RUN(test_memory_resource);
+    TEST_RUN(test_allocator);
+    TEST_RUN(test_fixed_size);
+    TEST_RUN(test_vector);
+
+    if (test_failure_count > 0) std::printf("%d check(s) failed.\n", test_failure_count);
+    return (test_failure_count > 0) ? 1 : 0;
+
+}
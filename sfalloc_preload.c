@@ -0,0 +1,206 @@
+// --- SF Allocator Preload Library --------------------------------------------
+//
+// Written by Chris DeJong, GitHub @ magictrickdev
+//
+//      Builds as libsfalloc.so and replaces the C-standard library allocation
+//      routines with SF allocator. This allows existing binaries to be run on top
+//      of the allocator without recompiling them:
+//
+//          LD_PRELOAD=./libsfalloc.so ./your-program
+//
+//      The allocator's state is constant-initialized, so the first malloc call
+//      made by the dynamic loader or libc (which may come before any constructor
+//      has run) is handled like any other call. The constructor below simply makes
+//      the initial reservation up-front and registers the fork handlers.
+//
+//      Setting SFA_DECAY_MS starts the decay thread with the given decay time, so
+//      free pages are purged in the background rather than as they are freed.
+//      Setting SFA_PRESSURE_MONITOR purges every heap whenever the kernel reports
+//      memory stalls of 150ms or more within a two second window.
+//
+// -----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#define SFA_IMPLEMENTATION
+#include "sfallocator.h"
+
+#define SFA_EXPORT __attribute__((visibility("default")))
+
+__attribute__((constructor)) static void
+__sfa_preload_initialize()
+{
+
+    // The fork handlers hold every heap lock across a fork, so the child never
+    // inherits a heap which another thread was halfway through modifying.
+    sf_init(SFA_DEFAULT_INITIAL_POOL_SIZE);
+    __sfa_fork_register();
+
+    const char *decay_milliseconds = getenv("SFA_DECAY_MS");
+    if (decay_milliseconds != NULL) sf_decay_start(strtoull(decay_milliseconds, NULL, 10));
+    if (getenv("SFA_PRESSURE_MONITOR") != NULL) sf_pressure_monitor_start(150000, 2000000);
+
+}
+
+static inline void*
+__sfa_preload_alloc_aligned(size_t size, size_t alignment)
+{
+
+    void *ptr = sf_alloc_aligned(size, alignment);
+    if (ptr == NULL) errno = ENOMEM;
+    return ptr;
+
+}
+
+// --- Exported Symbols --------------------------------------------------------
+//
+// Replacements for the standard allocation routines, see the glibc manual on
+// "Replacing malloc" for the set of functions which must be provided together.
+//
+
+SFA_EXPORT void*
+malloc(size_t size)
+{
+
+    void *ptr = sf_alloc(size);
+    if (ptr == NULL) errno = ENOMEM;
+    return ptr;
+
+}
+
+SFA_EXPORT void
+free(void *ptr)
+{
+
+    sf_free(ptr);
+
+}
+
+SFA_EXPORT void*
+calloc(size_t count, size_t size)
+{
+
+    size_t total_size = 0;
+    if (__builtin_mul_overflow(count, size, &total_size))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Pages which are known to be zero are left untouched.
+    void *ptr = sf_alloc_zeroed(total_size);
+    if (ptr == NULL) errno = ENOMEM;
+    return ptr;
+
+}
+
+SFA_EXPORT void*
+realloc(void *ptr, size_t size)
+{
+
+    if (ptr == NULL) return malloc(size);
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+
+    // Resize in place whenever possible, shrinking only gives back memory when
+    // at least half of the block would be released.
+    uint64_t usable_size = sf_usable_size(ptr);
+    if (size <= usable_size)
+    {
+        if (size <= usable_size / 2) sf_shrink(ptr, size);
+        return ptr;
+    }
+
+    if (sf_try_expand(ptr, size)) return ptr;
+
+    void *new_ptr = malloc(size);
+    if (new_ptr == NULL) return NULL;
+    memcpy(new_ptr, ptr, usable_size);
+    free(ptr);
+    return new_ptr;
+
+}
+
+SFA_EXPORT void*
+reallocarray(void *ptr, size_t count, size_t size)
+{
+
+    size_t total_size = 0;
+    if (__builtin_mul_overflow(count, size, &total_size))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return realloc(ptr, total_size);
+
+}
+
+SFA_EXPORT int
+posix_memalign(void **out_ptr, size_t alignment, size_t size)
+{
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment % sizeof(void*) != 0)
+        return EINVAL;
+
+    void *ptr = sf_alloc_aligned(size, alignment);
+    if (ptr == NULL) return ENOMEM;
+    *out_ptr = ptr;
+    return 0;
+
+}
+
+SFA_EXPORT void*
+aligned_alloc(size_t alignment, size_t size)
+{
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return __sfa_preload_alloc_aligned(size, alignment);
+
+}
+
+SFA_EXPORT void*
+memalign(size_t alignment, size_t size)
+{
+
+    return aligned_alloc(alignment, size);
+
+}
+
+SFA_EXPORT void*
+valloc(size_t size)
+{
+
+    return __sfa_preload_alloc_aligned(size, __sfa_virtual_size());
+
+}
+
+SFA_EXPORT void*
+pvalloc(size_t size)
+{
+
+    uint64_t page_size = __sfa_virtual_size();
+    uint64_t rounded_size = (size + page_size - 1) & ~(page_size - 1);
+    return __sfa_preload_alloc_aligned(rounded_size, page_size);
+
+}
+
+SFA_EXPORT size_t
+malloc_usable_size(void *ptr)
+{
+
+    return sf_usable_size(ptr);
+
+}
@@ -9,7 +9,10 @@
 //      To disable this (and to use the defaults provided by the C-standard library),
 //      define SF_USE_SSE_INTRINSICS to 0.
 //
-//      Drop this header file into your project and include it as desired.
+//      Drop this header file into your project and include it as desired. In
+//      exactly one source file, define SFA_IMPLEMENTATION before including it
+//      so that the implementation (and the allocator's global state) is emitted
+//      once for the entire program.
 //
 //      To reserve a set amount of contiguous pages, use sf_init(). This function
 //      silently fails if pages are already reserved.
@@ -23,9 +26,206 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-void    sf_init(uint64_t reserve_size);
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Heaps are independent sets of pools with their own lock. The sf_alloc family
+// operates on the default heap, passing NULL as a heap does the same. Any pointer
+// may be released with sf_free regardless of which heap it came from.
+typedef struct sfa_state sfa_heap;
+
+// Creates the default heap's initial pool. Fails, leaving the default heap as it was,
+// if the pool can't be mapped (or locked, see SFA_HEAP_LOCKED). Initializing an
+// already initialized heap does nothing and succeeds.
+bool    sf_init(uint64_t reserve_size);
+bool    sf_init_ext(uint64_t reserve_size, uint64_t flags);
+
+// Places the default heap's initial pool inside of the given memory rather than
+// mapping it, the memory must outlive every allocation made from it. Fails if the
+// default heap is already initialized or the memory can't hold a minimum pool. The
+// OS isn't involved until the heap outgrows the memory, which is also when the
+// container memory limit is first read, the same as for any other heap.
+bool    sf_init_with_buffer(void *memory, uint64_t size);
 void*   sf_alloc(uint64_t size);
+void*   sf_alloc_aligned(uint64_t size, uint64_t alignment);
+void*   sf_alloc_at_least(uint64_t size, uint64_t *actual_size);
+void*   sf_alloc_near(void *hint, uint64_t size);
+void*   sf_alloc_zeroed(uint64_t size);
+
+// Routes the allocation to the pools of the given lifetime, see SFA_LIFETIME_SHORT.
+// The block is an ordinary one whatever the lifetime, released with sf_free.
+void*   sf_alloc_hint(uint64_t size, uint64_t lifetime);
+
+// Packs the allocation back to back with other permanent ones into the pools of
+// SFA_LIFETIME_PERMANENT, without a descriptor of its own. The block lives until the
+// process exits. It must never be passed to sf_free, sf_usable_size or any other
+// function taking an allocation, since none of them can tell it apart.
+void*   sf_alloc_permanent(uint64_t size);
+
+// Lays out several parts contiguously in a single allocation, in the order given.
+// Alignments may be NULL for the natural alignment. Returns the group, which is
+// also the first part's pointer, and is released as one unit with sf_free_group.
+void*   sf_alloc_group(const uint64_t *sizes, const uint64_t *alignments, uint32_t count, void **out_ptrs);
+void    sf_free_group(void *group);
 void    sf_free(void *ptr);
+uint64_t sf_usable_size(void *ptr);
+
+// In-place resizing, neither function ever moves the allocation. Expanding only
+// succeeds if the block can grow into free memory directly to its right, shrinking
+// returns the unused tail to the pool and reports whether any memory was released.
+bool    sf_try_expand(void *ptr, uint64_t new_size);
+bool    sf_shrink(void *ptr, uint64_t new_size);
+void    sf_free_sized(void *ptr, uint64_t size);
+
+// Size class entry points for callers which know their size class up front, see
+// SFA_SIZE_CLASS_OF. Blocks of class i hold (i + 1) * SFA_ALLOCATION_ALIGNMENT_SIZE
+// bytes and must be released with the same class (or with sf_free).
+void*   sf_alloc_class(uint64_t class_index);
+void    sf_free_class(void *ptr, uint64_t class_index);
+
+// Meshed size classes, Linux only. Blocks come from single page spans of a memfd
+// backed arena and must be released with sf_mesh_free. Meshing merges spans of the
+// same class whose occupied blocks don't overlap onto one physical page, remapping
+// the virtual pages so that no pointer changes, and reports the bytes reclaimed.
+//
+// A span is write-protected while its blocks are copied. Other threads may keep
+// using their blocks: a store into a span being meshed faults into a SIGSEGV handler
+// (installed with the first meshed block, passing any other fault on to the handler
+// it replaced) which waits for the span to be remapped and then retries the store.
+// A SIGSEGV handler installed later on must pass faults on in the same way.
+//
+// The arena isn't inherited across fork, meshed blocks can't be used in the child
+// and sf_heap_snapshot fails while any of them are live.
+void*   sf_mesh_alloc(uint64_t class_index);
+void    sf_mesh_free(void *ptr);
+uint64_t sf_mesh(void);
+
+// Handles refer to movable blocks, which the heap's compactor may slide towards the
+// start of their pool. A handle is locked to get at its block and the pointer is only
+// valid until the matching unlock. Zero is never a valid handle. Handle blocks are
+// only ever released through their handle, sf_free rejects them, and destroying a
+// heap releases every handle into it, which must not be locked at the time.
+typedef uint64_t sfa_handle;
+
+sfa_handle  sf_handle_alloc(sfa_heap *heap, uint64_t size);
+void        sf_handle_free(sfa_handle handle);
+void*       sf_handle_lock(sfa_handle handle);
+void        sf_handle_unlock(sfa_handle handle);
+
+// Slides unlocked handle blocks towards the start of their pools, merging the free
+// space in between into the pools' tails, until the time budget is spent. Each call
+// resumes where the previous one left off and reports the bytes moved.
+uint64_t    sf_heap_compact(sfa_heap *heap, uint64_t budget_microseconds);
+
+// Growable buffers expand in place into free neighboring memory when they can and
+// only move otherwise. Zero initialize a buffer to use it on the default heap, or
+// set its heap before the first reservation.
+typedef struct sfa_buffer
+{
+
+    sfa_heap   *heap;
+    void       *data;
+    uint64_t    size;
+    uint64_t    capacity;
+
+} sfa_buffer;
+
+bool    sf_buffer_reserve(sfa_buffer *buffer, uint64_t capacity);
+bool    sf_buffer_try_grow(sfa_buffer *buffer, uint64_t capacity);
+void    sf_buffer_shrink_to_fit(sfa_buffer *buffer);
+bool    sf_buffer_append(sfa_buffer *buffer, const void *data, uint64_t size);
+void    sf_buffer_release(sfa_buffer *buffer);
+
+sfa_heap*   sf_heap_create(uint64_t reserve_size);
+sfa_heap*   sf_heap_create_ext(uint64_t reserve_size, uint64_t flags);
+void        sf_heap_destroy(sfa_heap *heap);
+void*       sf_heap_alloc(sfa_heap *heap, uint64_t size);
+void*       sf_heap_alloc_aligned(sfa_heap *heap, uint64_t size, uint64_t alignment);
+void*       sf_heap_alloc_zeroed(sfa_heap *heap, uint64_t size);
+
+// Returns the whole pages inside of free blocks to the OS while keeping them mapped,
+// reporting the number of bytes purged. Free blocks of at least SFA_PURGE_THRESHOLD
+// bytes are purged as they are freed.
+uint64_t    sf_purge(void);
+uint64_t    sf_heap_purge(sfa_heap *heap);
+
+// Starts a background thread which purges free pages of every heap once they have
+// been free for longer than the decay time. The decay time is a single age threshold
+// rather than a curve: a free block is kept whole until it crosses it, and is then
+// purged in full by the next of the SFA_DECAY_STEPS sweeps per decay period. Purging
+// on free is skipped while it runs, calling it again only changes the decay time.
+bool        sf_decay_start(uint64_t decay_milliseconds);
+void        sf_decay_stop(void);
+
+// Limits are measured against the bytes of pools a heap has mapped, zero disables a
+// limit. Crossing the soft limit purges the heap and then invokes the heap's pressure
+// callbacks outside of the heap lock, so they may free memory. Allocations which
+// would need a new pool beyond the hard limit fail.
+typedef void (*sfa_pressure_callback)(sfa_heap *heap, uint64_t committed_size, void *user_data);
+
+void        sf_heap_set_limits(sfa_heap *heap, uint64_t soft_limit, uint64_t hard_limit);
+bool        sf_heap_add_pressure_callback(sfa_heap *heap, sfa_pressure_callback callback, void *user_data);
+void        sf_heap_remove_pressure_callback(sfa_heap *heap, sfa_pressure_callback callback, void *user_data);
+uint64_t    sf_heap_committed_size(sfa_heap *heap);
+
+// Linux only, watches /proc/pressure/memory from a helper thread. Whenever memory
+// stalls exceed stall_microseconds within a window, every heap is purged and the
+// thread caches drain themselves on their next refill. Returns false when the kernel
+// offers no pressure stall information.
+bool        sf_pressure_monitor_start(uint64_t stall_microseconds, uint64_t window_microseconds);
+void        sf_pressure_monitor_stop(void);
+
+// Bytes of pool memory currently locked into RAM by SFA_HEAP_LOCKED heaps, across
+// the entire process. A pool the OS refuses to lock fails, the error code of the
+// latest refusal is kept (errno, or GetLastError on Windows), 0 if there was none.
+// ENOMEM (ERROR_WORKING_SET_QUOTA) means the lock limit was reached, which is given
+// by sf_lock_limit: RLIMIT_MEMLOCK, or the maximum working set on Windows.
+uint64_t    sf_locked_size(void);
+int32_t     sf_lock_error(void);
+uint64_t    sf_lock_limit(void);
+
+// Visits every occupied block of a heap under its lock, stopping early once the
+// callback returns false. The callback must not allocate from or free to the heap,
+// blocks sitting in thread caches are visited as well.
+typedef bool (*sfa_walk_callback)(void *ptr, uint64_t size, void *user_data);
+
+bool        sf_heap_walk(sfa_heap *heap, sfa_walk_callback visit, void *user_data);
+
+// Walks a copy-on-write snapshot of the heap from a forked child process, so that it
+// can be serialized in the background while the heap carries on. Returns the child's
+// process id to wait on, or -1. Fails while any meshed blocks are live, since the
+// child couldn't read them. POSIX only.
+int64_t     sf_heap_snapshot(sfa_heap *heap, sfa_walk_callback visit, void *user_data);
+bool        sf_snapshot_wait(int64_t snapshot);
+
+// Shared heaps are a single fixed size region of shared memory guarded by a process
+// shared lock, named through shm_open or anonymous through a memfd when the name is
+// NULL. Each process may map the region at a different address, so blocks are linked
+// by offsets and objects are handed between processes by their offset. Blocks must be
+// released with sf_shared_heap_free. POSIX only, opening takes ownership of the file.
+//
+// Backed by a regular file, the region is a persistent heap image which only one
+// process may have open at a time. Saving syncs it to disk under the heap lock, and
+// opening it again later is a single mapping that pages in lazily and continues from
+// the same free list. The root is where a program keeps whatever it needs to find.
+typedef struct sfa_shared_heap sfa_shared_heap;
+
+sfa_shared_heap*    sf_shared_heap_create(const char *name, uint64_t size);
+sfa_shared_heap*    sf_shared_heap_create_file(const char *path, uint64_t size);
+sfa_shared_heap*    sf_shared_heap_open(const char *name);
+sfa_shared_heap*    sf_shared_heap_open_file(const char *path);
+bool                sf_shared_heap_save(sfa_shared_heap *heap);
+void                sf_shared_heap_set_root(sfa_shared_heap *heap, void *ptr);
+void*               sf_shared_heap_root(sfa_shared_heap *heap);
+sfa_shared_heap*    sf_shared_heap_open_fd(int file);
+int                 sf_shared_heap_fd(sfa_shared_heap *heap);
+void                sf_shared_heap_close(sfa_shared_heap *heap);
+bool                sf_shared_heap_unlink(const char *name);
+void*               sf_shared_heap_alloc(sfa_shared_heap *heap, uint64_t size);
+void                sf_shared_heap_free(sfa_shared_heap *heap, void *ptr);
+uint64_t            sf_shared_heap_offset(sfa_shared_heap *heap, void *ptr);
+void*               sf_shared_heap_pointer(sfa_shared_heap *heap, uint64_t offset);
 //void*   sf_alloc_ext(uint64_t size, bool touch_pages, bool zero_pages, bool fast);
 //void*   sf_alloc_large(uint64_t size, uint64_t *size_out);
 
@@ -33,6 +233,10 @@ void    sf_free(void *ptr);
 //void    sf_memset(void *buffer, uint64_t size, uint8_t byte);
 //void    sf_memcopy(void *dst, uint64_t dst_size, void *src, uint64_t src_size);
 
+#ifdef __cplusplus
+}
+#endif
+
 #define SFA_BYTES(n)            (uint64_t)(n)
 #define SFA_KILOBYTES(n)        (uint64_t)(1024 * SFA_BYTES(n))
 #define SFA_MEGABYTES(n)        (uint64_t)(1024 * SFA_KILOBYTES(n))
@@ -50,24 +254,186 @@ void    sf_free(void *ptr);
 
 #define SFA_ALLOCATION_ALIGNMENT_SIZE           (sizeof(uint64_t)*4)
 #define SFA_ALLOCATION_MINIMUM_SIZE             (sizeof(uint64_t)*4)
+#define SFA_ALLOCATION_MAXIMUM_SIZE             (SFA_TERABYTES(64))
 #define SFA_ALLOCATION_MINIMUM_PAGES_PER_POOL   (4)
 #define SFA_DEFAULT_INITIAL_POOL_SIZE           (SFA_KILOBYTES(256))
+#define SFA_HUGE_PAGE_SIZE                      (SFA_MEGABYTES(2))
+
+// Heap flags, given to sf_init_ext and sf_heap_create_ext.
+//
+//      SFA_HEAP_HUGE_PAGES     Pools are reserved in whole, aligned huge pages and
+//                              marked for transparent huge pages.
+//      SFA_HEAP_HUGETLB        Pools are mapped from the hugetlbfs reservation when
+//                              available, implies SFA_HEAP_HUGE_PAGES.
+//      SFA_HEAP_PREFAULT       The initial reservation is faulted in up-front, split
+//                              across up to one thread per processor.
+//      SFA_HEAP_LOCKED         Pools are locked into RAM as they are mapped and never
+//                              purged. Locked pools count against RLIMIT_MEMLOCK (the
+//                              minimum working set on Windows) unless the process may
+//                              exceed it, a pool the OS refuses to lock isn't created
+//                              and the allocation fails, as does sf_init_ext. The
+//                              reason is reported by sf_lock_error.
+#define SFA_HEAP_HUGE_PAGES                     ((uint64_t)1 << 0)
+#define SFA_HEAP_HUGETLB                        ((uint64_t)1 << 1)
+#define SFA_HEAP_PREFAULT                       ((uint64_t)1 << 2)
+#define SFA_HEAP_LOCKED                         ((uint64_t)1 << 3)
+
+// Lifetime hints, given to sf_alloc_hint.
+//
+//      SFA_LIFETIME_SHORT      Served by the default heap, same as sf_alloc.
+//      SFA_LIFETIME_LONG       Served by a heap of its own, so that short lived churn
+//                              never pins down the pages of long lived data.
+//      SFA_LIFETIME_PERMANENT  Served by a third heap, for data that lives as long as
+//                              the process. sf_alloc_permanent packs allocations back
+//                              to back into chunks of it, with no descriptor each but
+//                              the same alignment as any other. Requests larger than a
+//                              quarter of a chunk are given a block of their own.
+#define SFA_LIFETIME_SHORT                      (0)
+#define SFA_LIFETIME_LONG                       (1)
+#define SFA_LIFETIME_PERMANENT                  (2)
+
+#ifndef SFA_PERMANENT_CHUNK_SIZE
+#   define SFA_PERMANENT_CHUNK_SIZE             (SFA_KILOBYTES(64))
+#endif
+
+// Prefaulting hands out the reservation in chunks, and only starts another thread
+// for every chunk beyond the first.
+#define SFA_PREFAULT_CHUNK_SIZE                 (SFA_MEGABYTES(64))
+#define SFA_PREFAULT_MAXIMUM_THREADS            (16)
+
+// Define SFA_PURGE_THRESHOLD as 0 to only ever purge through sf_purge. Defining
+// SFA_PURGE_LAZY uses MADV_FREE, which is cheaper, but the kernel only reclaims the
+// pages under memory pressure and they no longer read back as zero.
+#ifndef SFA_PURGE_THRESHOLD
+#   define SFA_PURGE_THRESHOLD                  (SFA_MEGABYTES(1))
+#endif
+
+// Number of times the decay thread sweeps the heaps per decay period, which bounds
+// how late past the decay time a block is purged. It doesn't stagger the purging.
+#define SFA_DECAY_STEPS                         (4)
+
+// Emptied pools are retained per heap, up to the given number of bytes and for the
+// given number of milliseconds, so that bursts of allocations reuse them instead of
+// mapping fresh pools. Define the size as 0 to release emptied pools right away.
+// Under a cgroup or job memory limit, the size is capped to 1/32nd of the limit.
+#ifndef SFA_RETAINED_POOLS_MAXIMUM_SIZE
+#   define SFA_RETAINED_POOLS_MAXIMUM_SIZE      (SFA_MEGABYTES(8))
+#endif
+#ifndef SFA_RETAINED_POOLS_MAXIMUM_AGE
+#   define SFA_RETAINED_POOLS_MAXIMUM_AGE       (10000)
+#endif
+
+#define SFA_PRESSURE_CALLBACK_COUNT             (8)
+
+// Small blocks of the default heap are cached per-thread by size class, where each
+// size class is a multiple of the allocation alignment up to the maximum size.
+#define SFA_THREAD_CACHE_MAXIMUM_SIZE           (SFA_KILOBYTES(1))
+#define SFA_THREAD_CACHE_CLASS_COUNT            (SFA_THREAD_CACHE_MAXIMUM_SIZE / SFA_ALLOCATION_ALIGNMENT_SIZE)
+#define SFA_THREAD_CACHE_DEPTH                  (64)
+#define SFA_THREAD_CACHE_REFILL                 (8)
+
+// The mesh arena is reserved up-front, but only pages holding blocks are resident.
+// A span may be meshed with others until it backs the given number of pages, and
+// each span is compared against up to the given number of others per sf_mesh.
+#ifndef SFA_MESH_ARENA_SIZE
+#   define SFA_MESH_ARENA_SIZE                  (SFA_GIGABYTES(4))
+#endif
+#define SFA_MESH_MAXIMUM_PAGES                  (8)
+#define SFA_MESH_PROBES                         (64)
+
+// The handle table is reserved up-front for the maximum number of live handles.
+#ifndef SFA_HANDLE_MAXIMUM_COUNT
+#   define SFA_HANDLE_MAXIMUM_COUNT             (1 << 24)
+#endif
+
+// Compaction reads the clock once per the given number of visited descriptors, as
+// well as after every moved block.
+#define SFA_COMPACT_CLOCK_INTERVAL              (64)
+
+#define SFA_SIZE_CLASS_OF(size)     ((size) <= SFA_ALLOCATION_MINIMUM_SIZE ? 0 : \
+    (((size) + SFA_ALLOCATION_ALIGNMENT_SIZE - 1) / SFA_ALLOCATION_ALIGNMENT_SIZE) - 1)
+#define SFA_SIZE_CLASS_SIZE(index)  (((index) + 1) * SFA_ALLOCATION_ALIGNMENT_SIZE)
+
+#endif
+
+#if defined(SFA_IMPLEMENTATION) && !defined(SFA_IMPLEMENTATION_INCLUDED)
+#define SFA_IMPLEMENTATION_INCLUDED
+
+// -------------------------------------------------------------------------- //
+// *                                                                        * //
+//                                                                            //
+// *                                                                        * //
+//                                                                            //
+// *                         Implementation Below                           * //
+//                                                                            //
+// *                            Dragons Beyond                              * //
+//                                                                            //
+// *                                                                        * //
+//                                                                            //
+// *                                                                        * //
+// -------------------------------------------------------------------------- //
+
+
+
+// --- Platform Types ----------------------------------------------------------
+//
+// The allocator state is guarded by a single lock. The lock types are chosen
+// such that they can be statically initialized, meaning that the global state
+// is valid before any constructors run and there is no lazy initialization to
+// race with during process start-up.
+//
 
-// -------------------------------------------------------------------------- \\
-// *                                                                        * \\
-//                                                                            \\
-// *                                                                        * \\
-//                                                                            \\
-// *                         Implementation Below                           * \\
-//                                                                            \\
-// *                            Dragons Beyond                              * \\
-//                                                                            \\
-// *                                                                        * \\
-//                                                                            \\
-// *                                                                        * \\
-// -------------------------------------------------------------------------- \\
+#include <string.h>
+
+#if defined (_WIN32)
+#   include <windows.h>
+    typedef SRWLOCK sfa_lock;
+    typedef CONDITION_VARIABLE sfa_condition;
+    typedef HANDLE sfa_thread;
+#   define SFA_LOCK_INITIALIZER SRWLOCK_INIT
+#   define SFA_CONDITION_INITIALIZER CONDITION_VARIABLE_INIT
+#else
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <pthread.h>
+#   include <sys/file.h>
+#   include <sys/mman.h>
+#   include <sys/resource.h>
+#   include <sys/stat.h>
+#   include <sys/wait.h>
+#   include <time.h>
+#   include <unistd.h>
+#   if defined (__linux__)
+#       include <poll.h>
+#       include <sched.h>
+#       include <signal.h>
+#       include <stdio.h>
+#       include <stdlib.h>
+#       include <linux/falloc.h>
+#       include <sys/syscall.h>
+#   endif
+    typedef pthread_mutex_t sfa_lock;
+    typedef pthread_cond_t sfa_condition;
+    typedef pthread_t sfa_thread;
+#   define SFA_LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#   define SFA_CONDITION_INITIALIZER PTHREAD_COND_INITIALIZER
+#endif
 
+// Purged pages read back as zero, unless they were purged lazily. Windows only
+// offers the lazy variant.
+#if defined (_WIN32) || defined (SFA_PURGE_LAZY)
+#   define SFA_PURGE_ZERO_FILLS 0
+#else
+#   define SFA_PURGE_ZERO_FILLS 1
+#endif
 
+#if defined (__cplusplus)
+#   define SFA_THREAD_LOCAL thread_local
+#elif defined (_MSC_VER)
+#   define SFA_THREAD_LOCAL __declspec(thread)
+#else
+#   define SFA_THREAD_LOCAL _Thread_local
+#endif
 
 // --- Internal API ------------------------------------------------------------
 //
@@ -113,29 +479,188 @@ void    sf_free(void *ptr);
 // which only search for tails that can fit the allocation. This skips deep traversals
 // to find the best place to put an allocation.
 //
+// All internal functions assume that the caller holds the state lock.
+//
 
 typedef struct sfa_allocation_descriptor    sfa_allocation_descriptor;
 typedef struct sfa_pool_descriptor          sfa_pool_descriptor;
 typedef struct sfa_state                    sfa_state;
 typedef struct sfa_pool_search              sfa_pool_search;
+typedef struct sfa_thread_cache             sfa_thread_cache;
+typedef struct sfa_pressure_handler         sfa_pressure_handler;
+typedef struct sfa_shared_region            sfa_shared_region;
+typedef struct sfa_shared_block             sfa_shared_block;
+typedef struct sfa_mesh_span                sfa_mesh_span;
+typedef struct sfa_mesh_arena               sfa_mesh_arena;
+typedef struct sfa_handle_entry             sfa_handle_entry;
+typedef struct sfa_handle_table             sfa_handle_table;
+typedef struct sfa_lifetime_heaps           sfa_lifetime_heaps;
 
-inline void*        __sfa_virtual_alloc(void* offset, uint64_t size);
-inline void         __sfa_virtual_free(void* ptr);
-inline uint64_t     __sfa_virtual_size();
-inline sfa_state*   __sfa_get_state();
-inline uint64_t     __sfa_request_size_to_nearest_boundary(uint64_t size);
-inline uint64_t     __sfa_request_size_to_minimum_pool_size(uint64_t size);
-inline uint64_t     __sfa_request_size_to_minimum_alloc_size(uint64_t size);
-inline void*        __sfa_accomodate_allocation(uint64_t block, sfa_pool_search *search_results);
-inline void         __sfa_find_pool_for_alloc_fast(uint64_t size, sfa_pool_search *search_results);
-inline sfa_pool_descriptor* __sfa_create_pool(uint64_t pool_size);
+static inline void*        __sfa_virtual_alloc(void* offset, uint64_t size);
+static inline void*        __sfa_virtual_alloc_huge(uint64_t size, bool use_hugetlb);
+static inline void         __sfa_virtual_free(void* ptr, uint64_t size);
+static inline bool         __sfa_virtual_purge(void* ptr, uint64_t size);
+static inline void         __sfa_virtual_prefault(void* ptr, uint64_t size);
+static inline int32_t      __sfa_virtual_lock(void* ptr, uint64_t size);
+static inline uint64_t     __sfa_virtual_lock_limit();
+static inline void         __sfa_virtual_unlock(void* ptr, uint64_t size);
+static inline uint64_t     __sfa_processor_count();
+static inline uint64_t     __sfa_virtual_size();
+static inline void         __sfa_lock_init(sfa_lock *lock);
+static inline void         __sfa_lock_destroy(sfa_lock *lock);
+static inline void         __sfa_lock_acquire(sfa_lock *lock);
+static inline void         __sfa_lock_release(sfa_lock *lock);
+static inline void         __sfa_condition_wait(sfa_condition *condition, sfa_lock *lock, uint64_t milliseconds);
+static inline void         __sfa_condition_signal(sfa_condition *condition);
+static inline bool         __sfa_thread_create(sfa_thread *thread, void (*routine)(void));
+static inline void         __sfa_thread_join(sfa_thread thread);
+static inline uint64_t     __sfa_time_milliseconds();
+static inline uint64_t     __sfa_time_microseconds();
+static inline void         __sfa_fork_register();
+static inline int64_t      __sfa_process_fork();
+static inline void         __sfa_process_exit(bool success);
+static inline bool         __sfa_process_wait(int64_t process);
+static inline void*        __sfa_mesh_arena_map(uint64_t size, int *file);
+static inline bool         __sfa_mesh_page_map(void *page, int file, uint64_t file_offset, uint64_t size);
+static inline void         __sfa_mesh_page_release(int file, uint64_t file_offset, uint64_t size);
+static inline bool         __sfa_mesh_page_protect(void *page, uint64_t size, bool is_writable);
+static inline bool         __sfa_mesh_fault_register();
+static inline uint64_t     __sfa_memory_limit();
+static inline bool         __sfa_pressure_monitor_start(uint64_t stall_microseconds, uint64_t window_microseconds);
+static inline void         __sfa_pressure_monitor_stop();
+static inline int          __sfa_shared_memory_open(const char *name, bool create);
+static inline int          __sfa_shared_memory_anonymous();
+static inline int          __sfa_shared_file_open(const char *path, bool create);
+static inline void         __sfa_shared_file_remove(const char *path);
+static inline bool         __sfa_shared_memory_sync(void *ptr, uint64_t size);
+static inline void*        __sfa_shared_memory_map(int file, uint64_t *size, bool create);
+static inline void         __sfa_shared_memory_close(int file, void *ptr, uint64_t size);
+static inline bool         __sfa_shared_memory_unlink(const char *name);
+static inline bool         __sfa_shared_lock_init(sfa_lock *lock);
+static inline void         __sfa_shared_lock_acquire(sfa_lock *lock);
+static inline sfa_state*   __sfa_get_state();
+static inline sfa_state*   __sfa_get_heap_state(sfa_heap *heap);
+static inline uint64_t     __sfa_request_size_to_nearest_boundary(uint64_t size);
+static inline uint64_t     __sfa_request_size_to_minimum_pool_size(sfa_state *state, uint64_t size);
+static inline uint64_t     __sfa_request_size_to_minimum_alloc_size(uint64_t size);
+static inline void         __sfa_probe_memory_limit(sfa_state *state);
+static inline void         __sfa_initialize_heap(sfa_state *state, sfa_pool_descriptor *pool);
+static inline uint64_t     __sfa_pool_descriptor_size();
+static inline uint64_t     __sfa_allocation_descriptor_size();
+static inline sfa_allocation_descriptor* __sfa_get_descriptor(void *ptr);
+static inline void         __sfa_free_list_insert(sfa_pool_descriptor *pool, sfa_allocation_descriptor *node);
+static inline void         __sfa_free_list_remove(sfa_pool_descriptor *pool, sfa_allocation_descriptor *node);
+static inline void         __sfa_split_block(sfa_allocation_descriptor *node, uint64_t size);
+static inline void*        __sfa_accomodate_allocation(uint64_t block, sfa_pool_search *search_results);
+static inline void*        __sfa_accomodate_aligned_allocation(uint64_t block, uint64_t alignment, sfa_pool_search *search_results);
+static inline void*        __sfa_accomodate_allocation_near(uint64_t block, uint64_t hint, sfa_pool_search *search_results);
+static inline bool         __sfa_find_block_near(sfa_pool_descriptor *pool, uint64_t size, uint64_t hint, sfa_pool_search *search_results);
+static inline bool         __sfa_find_pool_for_alloc_fast(sfa_state *state, uint64_t size, sfa_pool_search *search_results);
+static inline bool         __sfa_find_pool_for_alloc_best_fit(sfa_state *state, uint64_t size, sfa_pool_search *search_results);
+static inline bool         __sfa_find_pool_for_alloc(sfa_state *state, uint64_t size, sfa_pool_search *search_results);
+static inline sfa_pool_descriptor* __sfa_format_pool(sfa_state *state, void *buffer, uint64_t reserve_size);
+static inline sfa_pool_descriptor* __sfa_create_pool(sfa_state *state, uint64_t pool_size);
+static inline void         __sfa_release_pool(sfa_pool_descriptor *pool);
+static inline sfa_pool_descriptor* __sfa_reuse_pool(sfa_state *state, uint64_t pool_size);
+static inline uint64_t     __sfa_trim_retained_pools(sfa_state *state, uint64_t maximum_size, uint64_t now);
+static inline bool         __sfa_lock_pool_memory(void *ptr, uint64_t size);
+static inline void         __sfa_unmap_pool(sfa_pool_descriptor *pool);
+static inline void*        __sfa_alloc_block(sfa_state *state, uint64_t block);
+static inline void         __sfa_free_block(sfa_state *state, sfa_allocation_descriptor *node);
+static inline bool         __sfa_expand_block(sfa_allocation_descriptor *node, uint64_t block);
+static inline bool         __sfa_shrink_block(sfa_allocation_descriptor *node, uint64_t block);
+static inline uint64_t     __sfa_purge_granularity(sfa_state *state);
+static inline bool         __sfa_purgeable_range(sfa_state *state, sfa_allocation_descriptor *node, uint64_t *begin, uint64_t *end);
+static inline uint64_t     __sfa_purge_block(sfa_state *state, sfa_allocation_descriptor *node);
+static inline uint64_t     __sfa_purge_heap(sfa_state *state);
+static inline void         __sfa_release_state(sfa_state *state);
+static inline void         __sfa_notify_pressure(sfa_state *state);
+static inline void         __sfa_relieve_pressure();
+static inline void         __sfa_registry_insert(sfa_state *state);
+static inline void         __sfa_registry_remove(sfa_state *state);
+static inline uint64_t     __sfa_decay_heap(sfa_state *state, uint64_t now);
+static void                __sfa_decay_thread();
+static void                __sfa_prefault_thread();
+static inline void         __sfa_prefault_pool(sfa_pool_descriptor *pool);
+static inline bool         __sfa_walk_heap(sfa_state *state, sfa_walk_callback visit, void *user_data);
+static void                __sfa_fork_prepare();
+static void                __sfa_fork_parent();
+static void                __sfa_fork_child();
+static inline bool         __sfa_mesh_initialize(sfa_mesh_arena *arena);
+static inline uint64_t     __sfa_mesh_object_count(sfa_mesh_arena *arena, uint64_t class_index);
+static inline void         __sfa_mesh_partial_insert(sfa_mesh_arena *arena, uint32_t span_index);
+static inline void         __sfa_mesh_partial_remove(sfa_mesh_arena *arena, uint32_t span_index);
+static inline uint32_t     __sfa_mesh_create_span(sfa_mesh_arena *arena, uint64_t class_index);
+static inline void         __sfa_mesh_release_span(sfa_mesh_arena *arena, uint32_t span_index);
+static inline bool         __sfa_mesh_spans(sfa_mesh_arena *arena, uint32_t span_index, uint32_t other_index);
+static inline sfa_handle_entry* __sfa_handle_entry(sfa_handle_table *table, sfa_handle handle);
+static inline sfa_handle   __sfa_handle_create(sfa_handle_table *table, sfa_state *state, void *ptr);
+static inline void         __sfa_handle_release(sfa_handle_table *table, sfa_handle_entry *entry);
+static inline sfa_allocation_descriptor* __sfa_compact_block(sfa_state *state, sfa_allocation_descriptor *node);
+static inline bool         __sfa_compact_pool(sfa_state *state, sfa_pool_descriptor *pool, uint64_t deadline, uint64_t *moved_size);
+static inline void         __sfa_compact_absorb(sfa_state *state, sfa_allocation_descriptor *node, sfa_allocation_descriptor *survivor);
+static inline sfa_state*   __sfa_lifetime_heap(sfa_lifetime_heaps *lifetimes, uint64_t lifetime);
+static inline void*        __sfa_permanent_alloc(sfa_lifetime_heaps *lifetimes, sfa_state *state, uint64_t size);
+static inline uint64_t     __sfa_thread_cache_class(uint64_t size);
+static inline sfa_thread_cache* __sfa_get_thread_cache();
+static inline void         __sfa_thread_cache_register(sfa_thread_cache *cache);
+static inline void         __sfa_thread_cache_flush(sfa_thread_cache *cache, uint64_t class_index, uint32_t count);
+static inline void         __sfa_thread_cache_drain(sfa_state *state, sfa_thread_cache *cache);
+static void                __sfa_thread_cache_release(void *cache);
+static inline void*        __sfa_thread_cache_pop(uint64_t class_index);
+static inline void*        __sfa_thread_cache_refill(uint64_t class_index);
+static inline bool         __sfa_thread_cache_push(void *ptr, uint64_t class_index);
+static inline uint64_t     __sfa_shared_region_size();
+static inline uint64_t     __sfa_shared_block_size();
+static inline sfa_shared_block* __sfa_shared_block_at(sfa_shared_region *region, uint64_t offset);
+static inline void         __sfa_shared_free_list_insert(sfa_shared_region *region, sfa_shared_block *block, uint64_t offset);
+static inline void         __sfa_shared_free_list_remove(sfa_shared_region *region, sfa_shared_block *block);
+static inline void*        __sfa_shared_alloc_block(sfa_shared_region *region, uint64_t size);
+static inline void         __sfa_shared_free_block(sfa_shared_region *region, sfa_shared_block *block);
+static inline sfa_shared_heap* __sfa_shared_heap_attach(int file, uint64_t size, bool create);
+static inline uint64_t     __sfa_shared_heap_region_size(uint64_t size);
+
+typedef struct sfa_pressure_handler
+{
+
+    sfa_pressure_callback   callback;
+    void                   *user_data;
+
+} sfa_pressure_handler;
 
 typedef struct sfa_state
 {
-    
+
     bool initialized;
+    sfa_lock lock;
     sfa_pool_descriptor *head_pool;
     sfa_pool_descriptor *tail_pool;
+    sfa_pool_descriptor *large_pools;   // Dedicated pools, never searched.
+    uint64_t flags;
+    uint64_t decay_time;                // Zero unless the decay thread is running.
+
+    // Emptied pools, newest first and singly linked.
+    sfa_pool_descriptor *retained_pools;
+    uint64_t retained_size;
+    uint64_t retained_limit;
+    bool memory_limit_probed;           // The cgroup limit is read with the first mapped pool.
+
+    // Registry links, guarded by the registry lock.
+    sfa_state *next_heap;
+    sfa_state *prev_heap;
+
+    // Every mapped pool counts towards the committed size, retained ones included.
+    uint64_t committed_size;
+    uint64_t soft_limit;
+    uint64_t hard_limit;
+    bool pressure_pending;
+    uint32_t pressure_epoch;            // Thread caches drain when this changes.
+    uint32_t pressure_handler_count;
+    sfa_pressure_handler pressure_handlers[SFA_PRESSURE_CALLBACK_COUNT];
+
+    // Where the next compaction step resumes, NULL to start over with the head pool.
+    sfa_pool_descriptor *compact_pool;
+    sfa_allocation_descriptor *compact_node;
 
 } sfa_state;
 
@@ -148,7 +673,7 @@ typedef struct sfa_pool_search
 // Describes a block of memory within a pool.
 typedef union sfa_allocation_flags
 {
-    
+
     uint64_t flags;
 
     struct
@@ -156,7 +681,11 @@ typedef union sfa_allocation_flags
 
         uint64_t is_occupied        : 1;    // Free blocks are marked 0, in-use is 1.
         uint64_t is_coallescable    : 1;    // If true, it is a large allocation.
-        uint64_t                    : 62;   // Remaining bits.
+        uint64_t is_purged          : 1;    // Whole pages of the free block are released.
+        uint64_t is_zeroed          : 1;    // Whole pages of the free block read as zero.
+        uint64_t is_movable         : 1;    // Owned by a handle, the compactor may move it.
+        uint64_t handle_index       : 32;   // Handle table entry of a movable block.
+        uint64_t                    : 27;   // Remaining bits.
 
     };
 
@@ -175,6 +704,11 @@ typedef struct sfa_allocation_descriptor
     uint64_t block_offset;
 
     uint64_t allocation_size;
+    uint64_t free_time;                 // When the block was freed, for decay purging.
+
+    // Free list links, only valid while the block is not occupied.
+    sfa_allocation_descriptor *next_free;
+    sfa_allocation_descriptor *prev_free;
 
 } sfa_allocation_descriptor;
 
@@ -182,6 +716,7 @@ typedef struct sfa_allocation_descriptor
 typedef struct sfa_pool_descriptor
 {
 
+    sfa_state                  *parent_state;
     sfa_pool_descriptor        *next_pool;
     sfa_pool_descriptor        *prev_pool;
     sfa_allocation_descriptor  *free_list;
@@ -189,49 +724,256 @@ typedef struct sfa_pool_descriptor
     void       *memory_region;
     uint64_t    memory_region_size;
     uint64_t    memory_region_occupancy;
+    uint64_t    reserve_size;
+    uint64_t    retain_time;
     bool        pool_is_large;
+    bool        pool_is_external;   // Caller provided memory, never unmapped or purged.
 
 } sfa_pool_descriptor;
 
-inline sfa_state*   
+// Per-thread cache of small default heap blocks. Cached blocks remain occupied as
+// far as their pool is concerned, the bins are singly linked through the first
+// word of each block.
+typedef struct sfa_thread_cache
+{
+
+    void       *bins[SFA_THREAD_CACHE_CLASS_COUNT];
+    uint32_t    counts[SFA_THREAD_CACHE_CLASS_COUNT];
+    uint32_t    pressure_epoch;
+    bool        is_registered;
+    bool        is_released;
+
+} sfa_thread_cache;
+
+static SFA_THREAD_LOCAL sfa_thread_cache sfa_thread_cache_state;
+
+// Every heap is linked into the registry, headed by the default heap, so that the
+// background threads can reach them. The registry lock is always acquired before
+// any heap lock.
+typedef struct sfa_registry
+{
+
+    sfa_lock        lock;
+    sfa_condition   condition;
+    sfa_thread      decay_thread;
+    uint64_t        decay_time;
+    bool            decay_running;
+    sfa_thread      pressure_monitor_thread;
+    bool            pressure_monitor_running;
+
+} sfa_registry;
+
+// Prefaulting threads claim chunks of the current job under its lock, the serial
+// lock is held by the thread running the job for its entire duration.
+typedef struct sfa_prefault_job
+{
+
+    sfa_lock    lock;
+    sfa_lock    serial_lock;
+    uint8_t    *cursor;
+    uint8_t    *end;
+
+} sfa_prefault_job;
+
+// Bytes locked by every locked heap, the OS enforces the process' lock limit. The
+// lock is always acquired last, under a heap lock.
+typedef struct sfa_memory_lock
+{
+
+    sfa_lock    lock;
+    uint64_t    locked_size;
+    int32_t     lock_error;             // The latest lock the OS refused, 0 if none.
+
+} sfa_memory_lock;
+
+// Shared heaps begin with their region descriptor, followed by blocks which are
+// linked by their offset from the start of the region. Offset zero is the region
+// descriptor itself, so it doubles as the null link.
+#define SFA_SHARED_HEAP_MAGIC                   (0x4552414853414653ull)
+
+typedef struct sfa_shared_region
+{
+
+    uint64_t    magic;
+    uint64_t    region_size;
+    uint64_t    free_list;
+    uint64_t    root;
+    sfa_lock    lock;               // Process-shared.
+
+} sfa_shared_region;
+
+typedef struct sfa_shared_block
+{
+
+    uint64_t    block_size;         // Bytes following the block's descriptor.
+    uint64_t    is_occupied;
+    uint64_t    left_block;
+    uint64_t    right_block;
+    uint64_t    next_free;
+    uint64_t    prev_free;
+
+} sfa_shared_block;
+
+// The process-local view of a shared heap.
+typedef struct sfa_shared_heap
+{
+
+    sfa_shared_region  *region;
+    uint64_t            region_size;
+    int                 file;
+
+} sfa_shared_heap;
+
+// Spans are indexed by the arena page which physically backs them, which is also the
+// first virtual page mapped onto them. Links are stored as index + 1, zero is none.
+typedef struct sfa_mesh_span
+{
+
+    uint64_t    occupied[2];        // Bitmap of occupied blocks, at most 128 per span.
+    uint32_t    class_index;
+    uint32_t    occupied_count;
+    uint32_t    page_count;         // Zero while the span is unused.
+    uint32_t    pages[SFA_MESH_MAXIMUM_PAGES];
+    uint32_t    next_span;          // Partial spans of a class, or released pages.
+    uint32_t    prev_span;
+
+} sfa_mesh_span;
+
+typedef struct sfa_mesh_arena
+{
+
+    sfa_lock        lock;
+    bool            initialized;
+    uint8_t        *base;
+    int             file;
+    uint64_t        page_size;
+    uint64_t        page_count;
+    uint64_t        page_cursor;
+    uint32_t        free_pages;
+    uint32_t       *page_spans;     // The span each virtual page is mapped onto.
+    sfa_mesh_span  *spans;
+    uint64_t        block_count;    // Occupied blocks across every span.
+    uint32_t        is_meshing;     // Atomic, set while a span is write-protected.
+    uint32_t        partial_spans[SFA_THREAD_CACHE_CLASS_COUNT];
+
+} sfa_mesh_arena;
+
+// Handle entries are linked through their next free entry while unused, and handles
+// are the entry's index + 1 with the entry's generation in the upper half.
+typedef struct sfa_handle_entry
+{
+
+    void       *block_pointer;
+    sfa_state  *parent_state;
+    uint32_t    lock_count;
+    uint32_t    generation;
+    uint32_t    next_free;
+
+} sfa_handle_entry;
+
+// The table lock is always acquired last, under the heap lock while compacting.
+typedef struct sfa_handle_table
+{
+
+    sfa_lock            lock;
+    sfa_handle_entry   *entries;
+    uint64_t            entry_count;
+    uint32_t            free_entries;
+
+} sfa_handle_table;
+
+// The lock only guards creating the heaps, the permanent chunk is guarded by the
+// permanent heap's lock.
+typedef struct sfa_lifetime_heaps
+{
+
+    sfa_lock    lock;
+    sfa_state  *long_heap;
+    sfa_state  *permanent_heap;
+    uint8_t    *permanent_cursor;
+    uint8_t    *permanent_end;
+
+} sfa_lifetime_heaps;
+
+// The global state is constant-initialized and therefore lives in the data
+// segment from the moment the image is loaded. Every field is given so that the
+// header compiles cleanly with -Wextra, in both C and C++, where designated
+// initializers aren't available.
+static sfa_state sfa_global_state =
+{
+    false, SFA_LOCK_INITIALIZER, NULL, NULL, NULL, 0, 0,
+    NULL, 0, 0, false,
+    NULL, NULL,
+    0, 0, 0, false, 0, 0, { { NULL, NULL } },
+    NULL, NULL
+};
+
+static sfa_registry sfa_global_registry =
+{
+    SFA_LOCK_INITIALIZER, SFA_CONDITION_INITIALIZER, 0, 0, false, 0, false
+};
+
+static sfa_prefault_job sfa_global_prefault_job = { SFA_LOCK_INITIALIZER, SFA_LOCK_INITIALIZER, NULL, NULL };
+static sfa_memory_lock sfa_global_memory_lock = { SFA_LOCK_INITIALIZER, 0, 0 };
+static sfa_mesh_arena sfa_global_mesh_arena =
+{
+    SFA_LOCK_INITIALIZER, false, NULL, 0, 0, 0, 0, 0, NULL, NULL, 0, 0, { 0 }
+};
+
+static sfa_handle_table sfa_global_handle_table = { SFA_LOCK_INITIALIZER, NULL, 0, 0 };
+static sfa_lifetime_heaps sfa_global_lifetime_heaps = { SFA_LOCK_INITIALIZER, NULL, NULL, NULL, NULL };
+
+static inline sfa_state*
 __sfa_get_state()
 {
 
-    static sfa_state state = {0};
-    if (state.initialized == false)
-    {
-        state.head_pool     = NULL;
-        state.tail_pool     = NULL;
-        state.initialized   = true;
-    }
+    return &sfa_global_state;
+
+}
+
+static inline sfa_state*
+__sfa_get_heap_state(sfa_heap *heap)
+{
 
-    return &state;
+    // The default heap is lazily given its initial reservation.
+    if (heap != NULL) return heap;
+    sfa_state *state = __sfa_get_state();
+    if (state->initialized == false) sf_init(SFA_DEFAULT_INITIAL_POOL_SIZE);
+    return state;
 
 }
 
-inline uint64_t     
+static inline uint64_t
 __sfa_request_size_to_nearest_boundary(uint64_t size)
 {
 
     uint64_t remainder = size % SFA_ALLOCATION_ALIGNMENT_SIZE;
-    uint64_t boundary = size + remainder;
+    uint64_t boundary = (remainder > 0) ?
+        size + (SFA_ALLOCATION_ALIGNMENT_SIZE - remainder) : size;
     return boundary;
 
 }
 
-inline uint64_t     
-__sfa_request_size_to_minimum_pool_size(uint64_t size)
+static inline uint64_t
+__sfa_request_size_to_minimum_pool_size(sfa_state *state, uint64_t size)
 {
 
     uint64_t pool_size = __sfa_virtual_size();
     uint64_t pages_required = (size / pool_size) + (size % pool_size > 0);
-    pages_required = (pages_required > SFA_ALLOCATION_MINIMUM_PAGES_PER_POOL) ? 
+    pages_required = (pages_required > SFA_ALLOCATION_MINIMUM_PAGES_PER_POOL) ?
         pages_required : SFA_ALLOCATION_MINIMUM_PAGES_PER_POOL;
-    return pages_required * pool_size;
+    uint64_t reserve_size = pages_required * pool_size;
+
+    // Huge page heaps always reserve whole huge pages so that a pool never ends part
+    // way through one, leaving it to be split back into regular pages.
+    if (state->flags & SFA_HEAP_HUGE_PAGES)
+        reserve_size = (reserve_size + SFA_HUGE_PAGE_SIZE - 1) & ~(SFA_HUGE_PAGE_SIZE - 1);
+
+    return reserve_size;
 
 }
 
-inline uint64_t     
+static inline uint64_t
 __sfa_request_size_to_minimum_alloc_size(uint64_t size)
 {
 
@@ -241,43 +983,107 @@ __sfa_request_size_to_minimum_alloc_size(uint64_t size)
 
 }
 
-inline sfa_pool_descriptor* 
-__sfa_create_pool(uint64_t pool_size)
+static inline void
+__sfa_probe_memory_limit(sfa_state *state)
 {
 
-    // Size and allocate. Virtual alloc can potentially fail, but only if the OS-call
-    // is poorly formatted *OR* somehow we hit the virtual allocation limit.
-    uint64_t actual_reserve_size = __sfa_request_size_to_minimum_pool_size(pool_size);
-    void *alloc_buffer = __sfa_virtual_alloc(NULL, actual_reserve_size);
-    SFA_ASSERT_POINTER(alloc_buffer);
-
-    // Create the pool, set the pool next and prev to NULL. The invokee of this
-    // function is responsible for placing it in the list.
-    sfa_pool_descriptor *pool = (sfa_pool_descriptor*)alloc_buffer;
+    // NOTE(Chris): Reading the cgroup limit opens files, so it waits until the heap
+    //              maps its first pool. Heaps which live in caller provided memory
+    //              never touch the OS until they have to grow.
+    state->memory_limit_probed = true;
+    uint64_t memory_limit = __sfa_memory_limit();
+    state->retained_limit = SFA_RETAINED_POOLS_MAXIMUM_SIZE;
+    if (memory_limit > 0 && memory_limit / 32 < state->retained_limit) state->retained_limit = memory_limit / 32;
+
+    // Within a memory limited container, the default heap starts pushing back well
+    // before the kernel's OOM killer would.
+    if (state == __sfa_get_state() && memory_limit > 0 && state->soft_limit == 0)
+        state->soft_limit = memory_limit - memory_limit / 8;
+
+}
+
+static inline void
+__sfa_initialize_heap(sfa_state *state, sfa_pool_descriptor *pool)
+{
+
+    // The initial pool is the heap's head pool, which is never released.
+    state->head_pool = pool;
+    state->tail_pool = pool;
+    state->initialized = true;
+
+}
+
+static inline uint64_t
+__sfa_pool_descriptor_size()
+{
+
+    return __sfa_request_size_to_nearest_boundary(sizeof(sfa_pool_descriptor));
+
+}
+
+static inline uint64_t
+__sfa_allocation_descriptor_size()
+{
+
+    return __sfa_request_size_to_nearest_boundary(sizeof(sfa_allocation_descriptor));
+
+}
+
+static inline sfa_allocation_descriptor*
+__sfa_get_descriptor(void *ptr)
+{
+
+    // Every user pointer is placed directly after its descriptor, so we can walk
+    // backwards a fixed distance to get to it.
+    uint8_t *descriptor = (uint8_t*)ptr - __sfa_allocation_descriptor_size();
+    return (sfa_allocation_descriptor*)descriptor;
+
+}
+
+static inline sfa_pool_descriptor*
+__sfa_format_pool(sfa_state *state, void *buffer, uint64_t reserve_size)
+{
+
+    uint64_t offset_size = __sfa_pool_descriptor_size();
+    uint64_t block_offset = __sfa_allocation_descriptor_size();
+
+    // Lays out the pool at the front of the given memory, set the pool next and prev
+    // to NULL. The invokee of this function is responsible for placing it in the list.
+    sfa_pool_descriptor *pool = (sfa_pool_descriptor*)buffer;
+    pool->parent_state = state;
     pool->next_pool = NULL;
     pool->prev_pool = NULL;
 
     // Defines the memory region that the pool descriptor refers to.
-    uint64_t offset_size = __sfa_request_size_to_nearest_boundary(sizeof(sfa_pool_descriptor));
-    uint8_t *memory_offset = (uint8_t*)alloc_buffer + offset_size;
-    SFA_ASSERT((uint64_t)memory_offset % SFA_ALLOCATION_ALIGNMENT_SIZE);
+    uint8_t *memory_offset = (uint8_t*)buffer + offset_size;
+    SFA_ASSERT((uint64_t)memory_offset % SFA_ALLOCATION_ALIGNMENT_SIZE == 0);
 
+    // NOTE(Chris): Occupancy only counts occupied blocks (descriptor + block), a
+    //              pool with zero occupancy is entirely free.
     pool->memory_region             = memory_offset;
-    pool->memory_region_size        = actual_reserve_size - offset_size;
-    pool->memory_region_occupancy   = sizeof(sfa_allocation_descriptor);
+    pool->memory_region_size        = reserve_size - offset_size;
+    pool->memory_region_occupancy   = 0;
+    pool->reserve_size              = reserve_size;
+    pool->retain_time               = 0;
     pool->pool_is_large             = false;
+    pool->pool_is_external          = false;
 
     // Finally, set the pool's initial free list.
     sfa_allocation_descriptor *free_list = (sfa_allocation_descriptor*)memory_offset;
+    free_list->flags.flags              = 0;
     free_list->flags.is_occupied        = false;
     free_list->flags.is_coallescable    = true;
+    free_list->flags.is_purged          = true;
+    free_list->flags.is_zeroed          = true;
     free_list->left_descriptor          = NULL;
     free_list->right_descriptor         = NULL;
     free_list->parent_pool              = pool;
-    free_list->allocation_size          = pool->memory_region_size - offset_size;
+    free_list->allocation_size          = pool->memory_region_size - block_offset;
+    free_list->free_time                = 0;
+    free_list->next_free                = NULL;
+    free_list->prev_free                = NULL;
 
     // Set the free block pointer and offset.
-    uint64_t block_offset = __sfa_request_size_to_nearest_boundary(sizeof(sfa_allocation_descriptor));
     void *free_region = (uint8_t*)memory_offset + block_offset;
     free_list->block_pointer = free_region;
     free_list->block_offset = block_offset;
@@ -287,179 +1093,4540 @@ __sfa_create_pool(uint64_t pool_size)
 
 }
 
-inline void
-__sfa_find_pool_for_alloc_fast(uint64_t size, sfa_pool_search *search_results)
+static inline sfa_pool_descriptor*
+__sfa_create_pool(sfa_state *state, uint64_t pool_size)
 {
 
-    sfa_state *state = __sfa_get_state();
-    SFA_ASSERT_POINTER(search_results);
+    // Size and allocate. Virtual alloc can potentially fail, but only if the OS-call
+    // is poorly formatted *OR* somehow we hit the virtual allocation limit. In that
+    // case the failure is passed along to the caller.
+    uint64_t offset_size = __sfa_pool_descriptor_size();
+    uint64_t block_offset = __sfa_allocation_descriptor_size();
+    uint64_t actual_reserve_size = __sfa_request_size_to_minimum_pool_size(state,
+            pool_size + offset_size + block_offset);
+    if (state->memory_limit_probed == false) __sfa_probe_memory_limit(state);
 
-    // Find a pool which its free-list head can fit the allocation.
-    sfa_pool_descriptor *current_pool = state->head_pool;
-    sfa_allocation_descriptor *free_spot = NULL;
-    while (current_pool != NULL)
+    // Retained pools are given up before the hard limit is allowed to fail the pool.
+    if (state->hard_limit > 0 && state->committed_size + actual_reserve_size > state->hard_limit)
     {
+        __sfa_trim_retained_pools(state, 0, __sfa_time_milliseconds());
+        if (state->committed_size + actual_reserve_size > state->hard_limit) return NULL;
+    }
 
-        if (current_pool->free_list->allocation_size >= size)
-        {
-
-            search_results->pool = current_pool;
-            search_results->list_node = &current_pool->free_list;
-            return;
-
-        }
+    void *alloc_buffer = (state->flags & SFA_HEAP_HUGE_PAGES) ?
+        __sfa_virtual_alloc_huge(actual_reserve_size, (state->flags & SFA_HEAP_HUGETLB) != 0) :
+        __sfa_virtual_alloc(NULL, actual_reserve_size);
+    if (alloc_buffer == NULL) return NULL;
 
+    // A locked heap would rather fail the allocation than hand out memory which could
+    // be swapped out from under it.
+    bool is_locked = (state->flags & SFA_HEAP_LOCKED) != 0;
+    if (is_locked && __sfa_lock_pool_memory(alloc_buffer, actual_reserve_size) == false)
+    {
+        __sfa_virtual_free(alloc_buffer, actual_reserve_size);
+        return NULL;
     }
 
-    // We didn't find a pool to accomodate the allocation, create a new pool instead.
-    sfa_pool_descriptor *new_pool = __sfa_create_pool(size + sizeof(sfa_pool_descriptor));
-    SFA_ASSERT_POINTER(new_pool);
+    uint64_t previous_committed_size = state->committed_size;
+    state->committed_size += actual_reserve_size;
 
-    new_pool->prev_pool = state->tail_pool;
-    new_pool->next_pool = NULL;
-    state->tail_pool = new_pool;
+    // Nothing has touched the pages yet, unless locking faulted every one of them in.
+    sfa_pool_descriptor *pool = __sfa_format_pool(state, alloc_buffer, actual_reserve_size);
+    pool->free_list->flags.is_purged = !is_locked;
 
-    SFA_ASSERT(new_pool->free_list->allocation_size >= size);
-    search_results->pool = new_pool;
-    search_results->list_node = &new_pool->free_list;
-    return;
+    // Crossing the soft limit purges what we can right away, the callbacks are left
+    // for when the heap lock is released.
+    if (state->soft_limit > 0 && previous_committed_size < state->soft_limit &&
+        state->committed_size >= state->soft_limit)
+    {
+        state->pressure_pending = true;
+        __sfa_purge_heap(state);
+    }
+
+    return pool;
 
 }
 
-inline void*        
-__sfa_accomodate_allocation(uint64_t block, sfa_pool_search *search_results)
+static inline void
+__sfa_release_pool(sfa_pool_descriptor *pool)
 {
 
-    // NOTE(Chris): This function assumes that the search results are valid and
-    //              that the list node it contains will be able to fit the allocation.
+    SFA_ASSERT_POINTER(pool);
+    SFA_ASSERT(pool->memory_region_occupancy == 0);
+    sfa_state *state = pool->parent_state;
 
-    SFA_ASSERT_POINTER(search_results);
-    SFA_ASSERT((*search_results->list_node)->allocation_size >= block);
+    if (pool->prev_pool != NULL) pool->prev_pool->next_pool = pool->next_pool;
+    if (pool->next_pool != NULL) pool->next_pool->prev_pool = pool->prev_pool;
+    if (state->large_pools == pool) state->large_pools = pool->next_pool;
+    if (state->head_pool == pool) state->head_pool = pool->next_pool;
+    if (state->tail_pool == pool) state->tail_pool = pool->prev_pool;
+    if (state->compact_pool == pool)
+    {
+        state->compact_pool = NULL;
+        state->compact_node = NULL;
+    }
 
-    // Pull stuff out to make things easier to see.
-    sfa_pool_descriptor *pool = search_results->pool;
-    sfa_allocation_descriptor **node = search_results->list_node;
+    // The pool is still a single free block spanning the whole region, so it can be
+    // handed out again exactly as it is.
+    uint64_t now = __sfa_time_milliseconds();
+    pool->retain_time = now;
+    pool->prev_pool = NULL;
+    pool->next_pool = state->retained_pools;
+    state->retained_pools = pool;
+    state->retained_size += pool->reserve_size;
+    __sfa_trim_retained_pools(state, state->retained_limit, now);
 
-    void *memory_block_begin = (*node)->block_pointer;
-    void *new_free_region = (uint8_t*)memory_block_begin + block;
+}
 
-    // Update the new block.
-    sfa_allocation_descriptor *new_descriptor = (sfa_allocation_descriptor*)new_free_region;
-    new_descriptor->flags.is_occupied = false;
-    new_descriptor->flags.is_coallescable = true;
-    new_descriptor->left_descriptor = *node;
-    new_descriptor->right_descriptor = (*node)->right_descriptor;
-    new_descriptor->allocation_size = (*node)->allocation_size - (*node)->block_offset - block;
+static inline sfa_pool_descriptor*
+__sfa_reuse_pool(sfa_state *state, uint64_t pool_size)
+{
 
-    // Left descriptor of the previous remains the same.
-    *node->right_descriptor = new_descriptor;
+    // Takes the newest retained pool which fits, but not one that's more than twice
+    // the size that would otherwise have been created.
+    uint64_t reserve_size = __sfa_request_size_to_minimum_pool_size(state,
+            pool_size + __sfa_pool_descriptor_size() + __sfa_allocation_descriptor_size());
+    sfa_pool_descriptor **link = &state->retained_pools;
+    while (*link != NULL)
+    {
 
-    // Update the pool's state.
-    pool->memory_region_occupancy += block + (*node)->block_offset;
+        sfa_pool_descriptor *pool = *link;
+        if (pool->reserve_size >= reserve_size && pool->reserve_size / 2 <= reserve_size)
+        {
+            *link = pool->next_pool;
+            state->retained_size -= pool->reserve_size;
+            pool->next_pool = NULL;
+            return pool;
+        }
+
+        link = &pool->next_pool;
 
-    return new_free_region; // This is the user pointer.
+    }
+
+    return NULL;
 
 }
 
+static inline uint64_t
+__sfa_trim_retained_pools(sfa_state *state, uint64_t maximum_size, uint64_t now)
+{
 
-// --- Win32 Definitions -------------------------------------------------------
-//
-// The following definitions defined the required OS-specific internal API methods.
-// Most of these functions are simply wrappers for the OS-equivelant calls and have
-// little overhead (aside from the OS call itself).
-//
+    // Releases every retained pool which is too old, or doesn't fit within the size
+    // limit after the newer pools in front of it.
+    uint64_t kept_size = 0;
+    uint64_t released_size = 0;
+    sfa_pool_descriptor **link = &state->retained_pools;
+    while (*link != NULL)
+    {
 
-#if defined (_WIN32)
-#include <windows.h>
+        sfa_pool_descriptor *pool = *link;
+        if (kept_size + pool->reserve_size > maximum_size ||
+            now - pool->retain_time >= SFA_RETAINED_POOLS_MAXIMUM_AGE)
+        {
+            *link = pool->next_pool;
+            state->retained_size -= pool->reserve_size;
+            state->committed_size -= pool->reserve_size;
+            released_size += pool->reserve_size;
+            __sfa_unmap_pool(pool);
+            continue;
+        }
 
-void* 
-__sfa_virtual_alloc(void* offset, uint64_t size)
-{
+        kept_size += pool->reserve_size;
+        link = &pool->next_pool;
 
-    void* buffer = VirtualAlloc(offset, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-    return buffer;
+    }
+
+    return released_size;
 
 }
 
-void 
-__sfa_virtual_free(void** ptr)
+static inline bool
+__sfa_lock_pool_memory(void *ptr, uint64_t size)
 {
 
-    SFA_ASSERT_POINTER(*ptr);  
-    VirtualFree(*ptr, 0, MEM_RELEASE);
-    *ptr = NULL;
+    // NOTE(Chris): The limit is left to the OS, which knows about every other lock in
+    //              the process and lets privileged processes (CAP_IPC_LOCK) past it.
+    //              A refused lock (ENOMEM or EPERM, or the working set quota on
+    //              Windows) leaves nothing locked, its error is kept for the caller.
+    sfa_memory_lock *memory_lock = &sfa_global_memory_lock;
+    __sfa_lock_acquire(&memory_lock->lock);
+
+    int32_t lock_error = __sfa_virtual_lock(ptr, size);
+    bool is_locked = (lock_error == 0);
+    if (is_locked) memory_lock->locked_size += size;
+    else memory_lock->lock_error = lock_error;
+
+    __sfa_lock_release(&memory_lock->lock);
+    return is_locked;
 
 }
 
-uint64_t
-__sfa_virtual_size()
+static inline void
+__sfa_unmap_pool(sfa_pool_descriptor *pool)
 {
 
-    // Cache this value, it never changes.
-    static uint64_t page_granularity = 0;
-    if (page_granularity == 0)
+    uint64_t reserve_size = pool->reserve_size;
+    if (pool->pool_is_external) return;
+    if (pool->parent_state->flags & SFA_HEAP_LOCKED)
     {
 
-        SYSTEM_INFO system_info = {0};
-        GetSystemInfo(&system_info);
-        page_granularity = system_info.dwAllocationGranularity;
+        __sfa_virtual_unlock(pool, reserve_size);
+
+        sfa_memory_lock *memory_lock = &sfa_global_memory_lock;
+        __sfa_lock_acquire(&memory_lock->lock);
+        memory_lock->locked_size -= reserve_size;
+        __sfa_lock_release(&memory_lock->lock);
 
     }
 
-    return page_granularity;
+    __sfa_virtual_free(pool, reserve_size);
 
 }
 
-#endif
+static inline void
+__sfa_free_list_insert(sfa_pool_descriptor *pool, sfa_allocation_descriptor *node)
+{
+
+    // The tail of the pool is always placed at the front of the free list so that
+    // the fast path only ever needs to inspect the head. Any other block goes in
+    // directly behind the tail, or at the front if the pool no longer has one.
+    sfa_allocation_descriptor *head = pool->free_list;
+    if (head == NULL || node->right_descriptor == NULL || head->right_descriptor != NULL)
+    {
+
+        node->prev_free = NULL;
+        node->next_free = head;
+        if (head != NULL) head->prev_free = node;
+        pool->free_list = node;
+
+    }
+
+    else
+    {
+
+        node->prev_free = head;
+        node->next_free = head->next_free;
+        if (head->next_free != NULL) head->next_free->prev_free = node;
+        head->next_free = node;
+
+    }
+
+}
+
+static inline void
+__sfa_free_list_remove(sfa_pool_descriptor *pool, sfa_allocation_descriptor *node)
+{
+
+    if (node->prev_free != NULL) node->prev_free->next_free = node->next_free;
+    else pool->free_list = node->next_free;
+    if (node->next_free != NULL) node->next_free->prev_free = node->prev_free;
+
+    node->next_free = NULL;
+    node->prev_free = NULL;
+
+}
+
+static inline void
+__sfa_split_block(sfa_allocation_descriptor *node, uint64_t size)
+{
+
+    // NOTE(Chris): Splits the node such that it retains exactly size bytes, and the
+    //              remainder becomes a new free block placed into the free list. The
+    //              caller guarantees the remainder can hold a descriptor + minimum.
+
+    uint64_t block_offset = __sfa_allocation_descriptor_size();
+    SFA_ASSERT(node->allocation_size >= size + block_offset + SFA_ALLOCATION_MINIMUM_SIZE);
+
+    uint8_t *new_free_region = (uint8_t*)node->block_pointer + size;
+    sfa_allocation_descriptor *new_descriptor = (sfa_allocation_descriptor*)new_free_region;
+    new_descriptor->flags.flags = 0;
+    new_descriptor->flags.is_occupied = false;
+    new_descriptor->flags.is_coallescable = true;
+    new_descriptor->flags.is_purged = node->flags.is_purged;
+    new_descriptor->flags.is_zeroed = node->flags.is_zeroed;
+    new_descriptor->left_descriptor = node;
+    new_descriptor->right_descriptor = node->right_descriptor;
+    new_descriptor->parent_pool = node->parent_pool;
+    new_descriptor->block_pointer = new_free_region + block_offset;
+    new_descriptor->block_offset = block_offset;
+    new_descriptor->allocation_size = node->allocation_size - size - block_offset;
+    new_descriptor->free_time = node->free_time;
+    new_descriptor->next_free = NULL;
+    new_descriptor->prev_free = NULL;
+
+    // Left descriptor of the previous remains the same.
+    if (node->right_descriptor != NULL) node->right_descriptor->left_descriptor = new_descriptor;
+    node->right_descriptor = new_descriptor;
+    node->allocation_size = size;
+
+    __sfa_free_list_insert(node->parent_pool, new_descriptor);
+
+}
+
+static inline bool
+__sfa_find_pool_for_alloc_fast(sfa_state *state, uint64_t size, sfa_pool_search *search_results)
+{
+
+    SFA_ASSERT_POINTER(search_results);
+
+    // Find a pool which its free-list head can fit the allocation.
+    sfa_pool_descriptor *current_pool = state->head_pool;
+    while (current_pool != NULL)
+    {
+
+        if (current_pool->free_list != NULL &&
+            current_pool->free_list->allocation_size >= size)
+        {
+
+            search_results->pool = current_pool;
+            search_results->list_node = &current_pool->free_list;
+            return true;
+
+        }
+
+        current_pool = current_pool->next_pool;
+
+    }
+
+    return false;
+
+}
+
+static inline bool
+__sfa_find_pool_for_alloc_best_fit(sfa_state *state, uint64_t size, sfa_pool_search *search_results)
+{
+
+    SFA_ASSERT_POINTER(search_results);
+
+    // Skip pools which can't accomodate the allocation at all, otherwise take the
+    // smallest block in the first pool that fits.
+    sfa_pool_descriptor *current_pool = state->head_pool;
+    while (current_pool != NULL)
+    {
+
+        uint64_t available = current_pool->memory_region_size - current_pool->memory_region_occupancy;
+        if (available >= size)
+        {
+
+            sfa_allocation_descriptor **best_node = NULL;
+            sfa_allocation_descriptor **current_node = &current_pool->free_list;
+            while (*current_node != NULL)
+            {
+
+                uint64_t current_size = (*current_node)->allocation_size;
+                if (current_size >= size && (best_node == NULL ||
+                    current_size < (*best_node)->allocation_size))
+                {
+                    best_node = current_node;
+                    if (current_size == size) break;
+                }
+
+                current_node = &(*current_node)->next_free;
+
+            }
+
+            if (best_node != NULL)
+            {
+
+                search_results->pool = current_pool;
+                search_results->list_node = best_node;
+                return true;
+
+            }
+
+        }
+
+        current_pool = current_pool->next_pool;
+
+    }
+
+    return false;
+
+}
+
+static inline bool
+__sfa_find_pool_for_alloc(sfa_state *state, uint64_t size, sfa_pool_search *search_results)
+{
+
+    if (__sfa_find_pool_for_alloc_fast(state, size, search_results)) return true;
+    if (__sfa_find_pool_for_alloc_best_fit(state, size, search_results)) return true;
+
+    // We didn't find a pool to accomodate the allocation, create a new pool instead.
+    // Anything that wouldn't fit in a default sized pool receives a pool of its own,
+    // which is kept in a separate list so that it is never searched.
+    uint64_t default_pool_size = __sfa_request_size_to_minimum_pool_size(state, SFA_DEFAULT_INITIAL_POOL_SIZE);
+    bool is_large = (size > default_pool_size / 2);
+    uint64_t pool_size = (is_large) ? size : default_pool_size;
+    sfa_pool_descriptor *new_pool = __sfa_reuse_pool(state, pool_size);
+    if (new_pool == NULL) new_pool = __sfa_create_pool(state, pool_size);
+    if (new_pool == NULL) return false;
+    new_pool->pool_is_large = is_large;
+
+    if (is_large)
+    {
+
+        new_pool->prev_pool = NULL;
+        new_pool->next_pool = state->large_pools;
+        if (state->large_pools != NULL) state->large_pools->prev_pool = new_pool;
+        state->large_pools = new_pool;
+
+    }
+
+    else
+    {
+
+        new_pool->prev_pool = state->tail_pool;
+        new_pool->next_pool = NULL;
+        if (state->tail_pool != NULL) state->tail_pool->next_pool = new_pool;
+        if (state->head_pool == NULL) state->head_pool = new_pool;
+        state->tail_pool = new_pool;
+
+    }
+
+    SFA_ASSERT(new_pool->free_list->allocation_size >= size);
+    search_results->pool = new_pool;
+    search_results->list_node = &new_pool->free_list;
+    return true;
+
+}
+
+static inline void*
+__sfa_accomodate_allocation(uint64_t block, sfa_pool_search *search_results)
+{
+
+    // NOTE(Chris): This function assumes that the search results are valid and
+    //              that the list node it contains will be able to fit the allocation.
+
+    SFA_ASSERT_POINTER(search_results);
+    SFA_ASSERT((*search_results->list_node)->allocation_size >= block);
+
+    // Pull stuff out to make things easier to see.
+    sfa_pool_descriptor *pool = search_results->pool;
+    sfa_allocation_descriptor *node = *search_results->list_node;
+    __sfa_free_list_remove(pool, node);
+
+    // Only split when the remainder is large enough to be useful, otherwise the
+    // slack is handed over to the allocation.
+    uint64_t minimum_split = block + node->block_offset + SFA_ALLOCATION_MINIMUM_SIZE;
+    if (node->allocation_size >= minimum_split) __sfa_split_block(node, block);
+
+    // Update the pool's state.
+    node->flags.is_occupied = true;
+    node->flags.is_purged = false;
+    node->flags.is_zeroed = false;
+    pool->memory_region_occupancy += node->block_offset + node->allocation_size;
+
+    return node->block_pointer; // This is the user pointer.
+
+}
+
+static inline void*
+__sfa_accomodate_aligned_allocation(uint64_t block, uint64_t alignment, sfa_pool_search *search_results)
+{
+
+    // NOTE(Chris): The search must be made with block + alignment + the size of a
+    //              descriptor and minimum allocation so that there is always room
+    //              for a leading free block in front of the aligned user pointer.
+
+    SFA_ASSERT_POINTER(search_results);
+    sfa_allocation_descriptor *node = *search_results->list_node;
+
+    uint64_t block_offset = node->block_offset;
+    uint64_t block_begin = (uint64_t)node->block_pointer;
+    uint64_t aligned_begin = (block_begin + alignment - 1) & ~(alignment - 1);
+
+    // Already aligned, this is a regular allocation.
+    if (aligned_begin == block_begin)
+        return __sfa_accomodate_allocation(block, search_results);
+
+    // Otherwise split off a leading free block which is large enough to hold its
+    // own descriptor and the minimum allocation size.
+    while (aligned_begin - block_begin < block_offset + SFA_ALLOCATION_MINIMUM_SIZE)
+        aligned_begin += alignment;
+
+    uint64_t leading_size = aligned_begin - block_begin - block_offset;
+    SFA_ASSERT(node->allocation_size >= leading_size + block_offset + block);
+    __sfa_split_block(node, leading_size);
+
+    sfa_pool_search aligned_results = { NULL, NULL };
+    aligned_results.pool = search_results->pool;
+    aligned_results.list_node = (node->right_descriptor->prev_free != NULL) ?
+        &node->right_descriptor->prev_free->next_free : &search_results->pool->free_list;
+    return __sfa_accomodate_allocation(block, &aligned_results);
+
+}
+
+
+static inline bool
+__sfa_find_block_near(sfa_pool_descriptor *pool, uint64_t size, uint64_t hint, sfa_pool_search *search_results)
+{
+
+    // Finds the free block in the pool which is closest to the hint, the distance
+    // being measured to the nearest edge of the block. Anything within the same
+    // cache line is as good as it gets, so the search stops there.
+    uint64_t best_distance = UINT64_MAX;
+    sfa_allocation_descriptor **best_node = NULL;
+    sfa_allocation_descriptor **current_node = &pool->free_list;
+    while (*current_node != NULL)
+    {
+
+        sfa_allocation_descriptor *node = *current_node;
+        if (node->allocation_size >= size)
+        {
+
+            uint64_t block_begin = (uint64_t)node->block_pointer;
+            uint64_t block_end = block_begin + node->allocation_size;
+            uint64_t distance = (block_begin >= hint) ? block_begin - hint : hint - block_end;
+            if (distance < best_distance)
+            {
+                best_distance = distance;
+                best_node = current_node;
+                if (distance <= 64) break;
+            }
+
+        }
+
+        current_node = &node->next_free;
+
+    }
+
+    if (best_node == NULL) return false;
+    search_results->pool = pool;
+    search_results->list_node = best_node;
+    return true;
+
+}
+
+static inline void*
+__sfa_accomodate_allocation_near(uint64_t block, uint64_t hint, sfa_pool_search *search_results)
+{
+
+    // Blocks to the right of the hint are allocated from their start as usual, but
+    // blocks to the left are allocated from their end so the allocation sits as
+    // close to the hint as possible.
+    SFA_ASSERT_POINTER(search_results);
+    sfa_allocation_descriptor *node = *search_results->list_node;
+
+    uint64_t block_offset = node->block_offset;
+    if ((uint64_t)node->block_pointer >= hint ||
+        node->allocation_size < block + block_offset + SFA_ALLOCATION_MINIMUM_SIZE)
+        return __sfa_accomodate_allocation(block, search_results);
+
+    __sfa_split_block(node, node->allocation_size - block - block_offset);
+
+    sfa_allocation_descriptor *trailing = node->right_descriptor;
+    sfa_pool_search trailing_results = { NULL, NULL };
+    trailing_results.pool = search_results->pool;
+    trailing_results.list_node = (trailing->prev_free != NULL) ?
+        &trailing->prev_free->next_free : &search_results->pool->free_list;
+    return __sfa_accomodate_allocation(block, &trailing_results);
+
+}
+
+static inline void*
+__sfa_alloc_block(sfa_state *state, uint64_t block)
+{
+
+    // Select the pool and then accomodate.
+    sfa_pool_search search_results = { NULL, NULL };
+    if (__sfa_find_pool_for_alloc(state, block, &search_results) == false) return NULL;
+
+    SFA_ASSERT_POINTER(search_results.pool);
+    SFA_ASSERT_POINTER(search_results.list_node);
+    void *user_ptr = __sfa_accomodate_allocation(block, &search_results);
+    SFA_ASSERT_POINTER(user_ptr);
+    return user_ptr;
+
+}
+
+static inline void
+__sfa_free_block(sfa_state *state, sfa_allocation_descriptor *node)
+{
+
+    sfa_pool_descriptor *pool = node->parent_pool;
+    pool->memory_region_occupancy -= node->block_offset + node->allocation_size;
+    node->flags.is_occupied = false;
+
+    // Coallesce with the right neighbor, absorbing it into this block.
+    sfa_allocation_descriptor *right = node->right_descriptor;
+    if (right != NULL && right->flags.is_occupied == false)
+    {
+
+        __sfa_free_list_remove(pool, right);
+        __sfa_compact_absorb(state, right, node);
+        node->allocation_size += right->block_offset + right->allocation_size;
+        node->right_descriptor = right->right_descriptor;
+        if (right->right_descriptor != NULL) right->right_descriptor->left_descriptor = node;
+
+    }
+
+    // Coallesce with the left neighbor, this block is absorbed into it. The left
+    // neighbor is re-inserted since it may have just become the pool's tail.
+    sfa_allocation_descriptor *left = node->left_descriptor;
+    if (left != NULL && left->flags.is_occupied == false)
+    {
+
+        __sfa_free_list_remove(pool, left);
+        __sfa_compact_absorb(state, node, left);
+        left->allocation_size += node->block_offset + node->allocation_size;
+        left->right_descriptor = node->right_descriptor;
+        if (node->right_descriptor != NULL) node->right_descriptor->left_descriptor = left;
+        node = left;
+
+    }
+
+    // The coallesced block now spans pages that were in use, so it can no longer
+    // claim to be purged.
+    node->flags.is_purged = false;
+    node->flags.is_zeroed = false;
+    node->free_time = (state->decay_time > 0) ? __sfa_time_milliseconds() : 0;
+    __sfa_free_list_insert(pool, node);
+
+    // Empty pools are retained or returned to the OS, except for the initial
+    // reservation. Large free blocks are purged right away, unless the decay thread
+    // will get to them.
+    if (pool->memory_region_occupancy == 0 && pool != state->head_pool && !pool->pool_is_external)
+        __sfa_release_pool(pool);
+    else if (state->decay_time == 0 && SFA_PURGE_THRESHOLD > 0 && node->allocation_size >= SFA_PURGE_THRESHOLD)
+        __sfa_purge_block(state, node);
+
+}
+
+static inline bool
+__sfa_expand_block(sfa_allocation_descriptor *node, uint64_t block)
+{
+
+    // Grows an occupied block into its free right neighbor, any remainder which is
+    // large enough to be useful is split back off into the free list.
+    SFA_ASSERT(node->flags.is_occupied);
+    if (node->allocation_size >= block) return true;
+
+    sfa_allocation_descriptor *right = node->right_descriptor;
+    if (right == NULL || right->flags.is_occupied) return false;
+
+    uint64_t combined_size = node->allocation_size + right->block_offset + right->allocation_size;
+    if (combined_size < block) return false;
+
+    sfa_pool_descriptor *pool = node->parent_pool;
+    uint64_t previous_size = node->allocation_size;
+    __sfa_free_list_remove(pool, right);
+    __sfa_compact_absorb(pool->parent_state, right, node);
+    node->allocation_size = combined_size;
+    node->right_descriptor = right->right_descriptor;
+    if (right->right_descriptor != NULL) right->right_descriptor->left_descriptor = node;
+
+    uint64_t minimum_split = block + node->block_offset + SFA_ALLOCATION_MINIMUM_SIZE;
+    if (node->allocation_size >= minimum_split) __sfa_split_block(node, block);
+
+    pool->memory_region_occupancy += node->allocation_size - previous_size;
+    return true;
+
+}
+
+static inline bool
+__sfa_shrink_block(sfa_allocation_descriptor *node, uint64_t block)
+{
+
+    // Releases the tail of an occupied block. A free right neighbor is absorbed
+    // first so the released tail coallesces with it, otherwise the tail must be
+    // large enough to stand as a block of its own.
+    SFA_ASSERT(node->flags.is_occupied);
+    if (block >= node->allocation_size) return false;
+
+    sfa_pool_descriptor *pool = node->parent_pool;
+    sfa_allocation_descriptor *right = node->right_descriptor;
+    uint64_t released_size = node->allocation_size - block;
+    bool right_is_free = (right != NULL && right->flags.is_occupied == false);
+    if (right_is_free == false && released_size < node->block_offset + SFA_ALLOCATION_MINIMUM_SIZE)
+        return false;
+
+    if (right_is_free)
+    {
+
+        __sfa_free_list_remove(pool, right);
+        __sfa_compact_absorb(pool->parent_state, right, node);
+        node->allocation_size += right->block_offset + right->allocation_size;
+        node->right_descriptor = right->right_descriptor;
+        if (right->right_descriptor != NULL) right->right_descriptor->left_descriptor = node;
+
+    }
+
+    __sfa_split_block(node, block);
+    node->right_descriptor->free_time = (pool->parent_state->decay_time > 0) ? __sfa_time_milliseconds() : 0;
+    pool->memory_region_occupancy -= released_size;
+    return true;
+
+}
+
+// --- Purging -----------------------------------------------------------------
+//
+// Free blocks keep their address range and their place in the free list, only the
+// whole pages between the block's descriptor and its end are handed back. Huge page
+// heaps purge in whole huge pages so that purging never breaks one apart.
+//
+// Fresh pools start out purged and zeroed since nothing has touched them yet. The
+// flags are carried over to the right half of a split, the split descriptor only
+// touches pages outside of the halves' whole pages, and cleared whenever a block is
+// allocated or coallesced. Locked heaps are never purged, the pages would only be
+// faulted straight back in.
+//
+
+static inline uint64_t
+__sfa_purge_granularity(sfa_state *state)
+{
+
+    return (state->flags & SFA_HEAP_HUGE_PAGES) ? SFA_HUGE_PAGE_SIZE : __sfa_virtual_size();
+
+}
+
+static inline bool
+__sfa_purgeable_range(sfa_state *state, sfa_allocation_descriptor *node, uint64_t *begin, uint64_t *end)
+{
+
+    uint64_t granularity = __sfa_purge_granularity(state);
+    uint64_t block_begin = (uint64_t)node->block_pointer;
+    uint64_t block_end = block_begin + node->allocation_size;
+    *begin = (block_begin + granularity - 1) & ~(granularity - 1);
+    *end = block_end & ~(granularity - 1);
+    return *end > *begin;
+
+}
+
+static inline uint64_t
+__sfa_purge_block(sfa_state *state, sfa_allocation_descriptor *node)
+{
+
+    SFA_ASSERT(node->flags.is_occupied == false);
+    if (node->flags.is_purged || (state->flags & SFA_HEAP_LOCKED)) return 0;
+    if (node->parent_pool->pool_is_external) return 0;
+
+    uint64_t purge_begin = 0;
+    uint64_t purge_end = 0;
+    if (__sfa_purgeable_range(state, node, &purge_begin, &purge_end) == false) return 0;
+    if (__sfa_virtual_purge((void*)purge_begin, purge_end - purge_begin) == false) return 0;
+
+    node->flags.is_purged = true;
+    node->flags.is_zeroed = SFA_PURGE_ZERO_FILLS;
+    return purge_end - purge_begin;
+
+}
+
+static inline uint64_t
+__sfa_purge_heap(sfa_state *state)
+{
+
+    uint64_t purged_size = __sfa_trim_retained_pools(state, 0, __sfa_time_milliseconds());
+    sfa_pool_descriptor *pools[2] = { state->head_pool, state->large_pools };
+    for (uint32_t list_index = 0; list_index < 2; ++list_index)
+    {
+
+        for (sfa_pool_descriptor *pool = pools[list_index]; pool != NULL; pool = pool->next_pool)
+        {
+
+            sfa_allocation_descriptor *node = pool->free_list;
+            for (; node != NULL; node = node->next_free)
+                purged_size += __sfa_purge_block(state, node);
+
+        }
+
+    }
+
+    return purged_size;
+
+}
+
+// --- Memory Pressure ---------------------------------------------------------
+//
+// Pressure callbacks run outside of the heap lock, since they are expected to free
+// memory back into the heap. Allocation paths which can create pools release the
+// heap lock through __sfa_release_state, which runs any pending callbacks.
+//
+
+static inline void
+__sfa_release_state(sfa_state *state)
+{
+
+    bool pressure_pending = state->pressure_pending;
+    state->pressure_pending = false;
+    __sfa_lock_release(&state->lock);
+    if (pressure_pending) __sfa_notify_pressure(state);
+
+}
+
+static inline void
+__sfa_notify_pressure(sfa_state *state)
+{
+
+    // The handlers are copied so that callbacks can add or remove handlers.
+    sfa_pressure_handler handlers[SFA_PRESSURE_CALLBACK_COUNT];
+    __sfa_lock_acquire(&state->lock);
+    uint32_t handler_count = state->pressure_handler_count;
+    uint64_t committed_size = state->committed_size;
+    memcpy(handlers, state->pressure_handlers, sizeof(sfa_pressure_handler) * handler_count);
+    __sfa_lock_release(&state->lock);
+
+    for (uint32_t index = 0; index < handler_count; ++index)
+        handlers[index].callback(state, committed_size, handlers[index].user_data);
+
+}
+
+static inline void
+__sfa_relieve_pressure()
+{
+
+    // Purging also drops the retained pools. Thread caches can't be reached from
+    // here, so they are told to drain the next time they take the heap lock.
+    sfa_registry *registry = &sfa_global_registry;
+    __sfa_lock_acquire(&registry->lock);
+
+    for (sfa_state *state = __sfa_get_state(); state != NULL; state = state->next_heap)
+    {
+
+        __sfa_lock_acquire(&state->lock);
+        __sfa_purge_heap(state);
+        state->pressure_epoch += 1;
+        __sfa_lock_release(&state->lock);
+
+    }
+
+    __sfa_lock_release(&registry->lock);
+
+}
+
+// --- Decay -------------------------------------------------------------------
+//
+// Purging on free is cheap to reason about, but memory which is reused shortly after
+// being freed is faulted right back in. The decay thread instead purges blocks once
+// they have been free for the decay time, sweeping every heap several times per
+// decay period so that blocks are purged at most a fraction of a period late.
+//
+
+static inline void
+__sfa_registry_insert(sfa_state *state)
+{
+
+    sfa_registry *registry = &sfa_global_registry;
+    sfa_state *default_state = __sfa_get_state();
+    __sfa_lock_acquire(&registry->lock);
+
+    state->decay_time = registry->decay_time;
+    state->prev_heap = default_state;
+    state->next_heap = default_state->next_heap;
+    if (default_state->next_heap != NULL) default_state->next_heap->prev_heap = state;
+    default_state->next_heap = state;
+
+    __sfa_lock_release(&registry->lock);
+
+}
+
+static inline void
+__sfa_registry_remove(sfa_state *state)
+{
+
+    sfa_registry *registry = &sfa_global_registry;
+    __sfa_lock_acquire(&registry->lock);
+
+    if (state->prev_heap != NULL) state->prev_heap->next_heap = state->next_heap;
+    if (state->next_heap != NULL) state->next_heap->prev_heap = state->prev_heap;
+    state->next_heap = NULL;
+    state->prev_heap = NULL;
+
+    __sfa_lock_release(&registry->lock);
+
+}
+
+static inline uint64_t
+__sfa_decay_heap(sfa_state *state, uint64_t now)
+{
+
+    uint64_t purged_size = __sfa_trim_retained_pools(state, state->retained_limit, now);
+    sfa_pool_descriptor *pools[2] = { state->head_pool, state->large_pools };
+    for (uint32_t list_index = 0; list_index < 2; ++list_index)
+    {
+
+        for (sfa_pool_descriptor *pool = pools[list_index]; pool != NULL; pool = pool->next_pool)
+        {
+
+            sfa_allocation_descriptor *node = pool->free_list;
+            for (; node != NULL; node = node->next_free)
+            {
+                if (node->flags.is_purged == false && now - node->free_time >= state->decay_time)
+                    purged_size += __sfa_purge_block(state, node);
+            }
+
+        }
+
+    }
+
+    return purged_size;
+
+}
+
+static void
+__sfa_decay_thread()
+{
+
+    sfa_registry *registry = &sfa_global_registry;
+    __sfa_lock_acquire(&registry->lock);
+
+    while (registry->decay_running)
+    {
+
+        for (sfa_state *state = __sfa_get_state(); state != NULL; state = state->next_heap)
+        {
+
+            // Blocks are timestamped under the heap lock, so the time must be taken
+            // under it too or a block freed in between would appear ancient.
+            __sfa_lock_acquire(&state->lock);
+            __sfa_decay_heap(state, __sfa_time_milliseconds());
+            __sfa_lock_release(&state->lock);
+
+        }
+
+        uint64_t interval = registry->decay_time / SFA_DECAY_STEPS;
+        __sfa_condition_wait(&registry->condition, &registry->lock, (interval > 0) ? interval : 1);
+
+    }
+
+    __sfa_lock_release(&registry->lock);
+
+}
+
+// --- Prefaulting -------------------------------------------------------------
+//
+// Faulting in a large reservation on first touch serializes on the touching thread,
+// so the reservation is instead faulted in by several threads at once. The pages
+// are faulted in without changing their contents, the pool may already be in use.
+//
+
+static void
+__sfa_prefault_thread()
+{
+
+    sfa_prefault_job *job = &sfa_global_prefault_job;
+    for (;;)
+    {
+
+        __sfa_lock_acquire(&job->lock);
+        uint8_t *chunk = job->cursor;
+        uint64_t chunk_size = (uint64_t)(job->end - job->cursor);
+        if (chunk_size > SFA_PREFAULT_CHUNK_SIZE) chunk_size = SFA_PREFAULT_CHUNK_SIZE;
+        job->cursor += chunk_size;
+        __sfa_lock_release(&job->lock);
+
+        if (chunk_size == 0) break;
+        __sfa_virtual_prefault(chunk, chunk_size);
+
+    }
+
+}
+
+static inline void
+__sfa_prefault_pool(sfa_pool_descriptor *pool)
+{
+
+    // The pages holding the descriptors are already resident.
+    uint64_t page_size = __sfa_virtual_size();
+    uint64_t region_begin = ((uint64_t)pool->memory_region + __sfa_allocation_descriptor_size() +
+            page_size - 1) & ~(page_size - 1);
+    uint64_t region_end = (uint64_t)pool + pool->reserve_size;
+    if (region_end <= region_begin) return;
+
+    uint64_t chunk_count = (region_end - region_begin + SFA_PREFAULT_CHUNK_SIZE - 1) / SFA_PREFAULT_CHUNK_SIZE;
+    uint64_t thread_count = __sfa_processor_count();
+    if (thread_count > SFA_PREFAULT_MAXIMUM_THREADS) thread_count = SFA_PREFAULT_MAXIMUM_THREADS;
+    if (thread_count > chunk_count) thread_count = chunk_count;
+
+    sfa_prefault_job *job = &sfa_global_prefault_job;
+    __sfa_lock_acquire(&job->serial_lock);
+    __sfa_lock_acquire(&job->lock);
+    job->cursor = (uint8_t*)region_begin;
+    job->end = (uint8_t*)region_end;
+    __sfa_lock_release(&job->lock);
+
+    // The calling thread works the job as well, any thread which fails to start
+    // just means there are fewer hands.
+    sfa_thread threads[SFA_PREFAULT_MAXIMUM_THREADS];
+    uint64_t started_count = 0;
+    for (uint64_t index = 1; index < thread_count; ++index)
+        if (__sfa_thread_create(&threads[started_count], __sfa_prefault_thread)) started_count += 1;
+
+    __sfa_prefault_thread();
+    for (uint64_t index = 0; index < started_count; ++index)
+        __sfa_thread_join(threads[index]);
+
+    __sfa_lock_release(&job->serial_lock);
+
+}
+
+// --- Snapshots ---------------------------------------------------------------
+//
+// Snapshots are forked, the child receives a copy-on-write view of every heap and
+// walks it while the parent carries on. The fork handlers hold the registry lock
+// and every heap lock across the fork, so that the child never inherits a heap that
+// is halfway through being modified. Background threads don't survive the fork,
+// so the child goes back to purging on free.
+//
+
+static inline bool
+__sfa_walk_heap(sfa_state *state, sfa_walk_callback visit, void *user_data)
+{
+
+    // Every pool is a chain of adjacent descriptors starting at its memory region.
+    sfa_pool_descriptor *pools[2] = { state->head_pool, state->large_pools };
+    for (uint32_t list_index = 0; list_index < 2; ++list_index)
+    {
+
+        for (sfa_pool_descriptor *pool = pools[list_index]; pool != NULL; pool = pool->next_pool)
+        {
+
+            sfa_allocation_descriptor *node = (sfa_allocation_descriptor*)pool->memory_region;
+            for (; node != NULL; node = node->right_descriptor)
+            {
+                if (node->flags.is_occupied && !visit(node->block_pointer, node->allocation_size, user_data))
+                    return false;
+            }
+
+        }
+
+    }
+
+    return true;
+
+}
+
+static void
+__sfa_fork_prepare()
+{
+
+    __sfa_lock_acquire(&sfa_global_registry.lock);
+    for (sfa_state *state = __sfa_get_state(); state != NULL; state = state->next_heap)
+        __sfa_lock_acquire(&state->lock);
+    __sfa_lock_acquire(&sfa_global_mesh_arena.lock);
+    __sfa_lock_acquire(&sfa_global_handle_table.lock);
+
+}
+
+static void
+__sfa_fork_parent()
+{
+
+    __sfa_lock_release(&sfa_global_handle_table.lock);
+    __sfa_lock_release(&sfa_global_mesh_arena.lock);
+    for (sfa_state *state = __sfa_get_state(); state != NULL; state = state->next_heap)
+        __sfa_lock_release(&state->lock);
+    __sfa_lock_release(&sfa_global_registry.lock);
+
+}
+
+static void
+__sfa_fork_child()
+{
+
+    sfa_registry *registry = &sfa_global_registry;
+    __sfa_lock_init(&registry->lock);
+    registry->decay_running = false;
+    registry->decay_time = 0;
+    registry->pressure_monitor_running = false;
+
+    for (sfa_state *state = __sfa_get_state(); state != NULL; state = state->next_heap)
+    {
+        __sfa_lock_init(&state->lock);
+        state->decay_time = 0;
+    }
+
+    // A prefault may have been running on another thread.
+    __sfa_lock_init(&sfa_global_prefault_job.lock);
+    __sfa_lock_init(&sfa_global_prefault_job.serial_lock);
+    __sfa_lock_init(&sfa_global_handle_table.lock);
+    __sfa_lock_init(&sfa_global_lifetime_heaps.lock);
+
+    // The mesh arena isn't inherited, the child starts over with a fresh one.
+    sfa_mesh_arena *arena = &sfa_global_mesh_arena;
+    if (arena->base != NULL)
+    {
+        __sfa_virtual_free(arena->page_spans, arena->page_count * sizeof(uint32_t));
+        __sfa_virtual_free(arena->spans, arena->page_count * sizeof(sfa_mesh_span));
+        __sfa_shared_memory_close(arena->file, NULL, 0);
+    }
+
+    memset(arena, 0, sizeof(sfa_mesh_arena));
+    __sfa_lock_init(&arena->lock);
+
+}
+
+// --- Meshing -----------------------------------------------------------------
+//
+// Every virtual page of the mesh arena starts out mapped onto the same page of the
+// arena's memfd and holds a single span of one size class. Two spans of a class
+// whose occupied blocks don't overlap are meshed by copying the blocks of one into
+// the other's physical page at the same offsets, then mapping its virtual pages onto
+// that physical page as well and releasing its own. Pointers never change, and a
+// block may be freed through any of the virtual pages of its span.
+//
+// A released virtual page is only ever reused with its own physical page, which is
+// unused by then since a span always keeps its own virtual page.
+//
+// The copied span's virtual pages are read-only from before the copy until they are
+// remapped, so no store can land on the physical page after it was copied. Stores
+// in the meantime fault, and the fault handler holds them until the flag clears.
+//
+
+static inline bool
+__sfa_mesh_initialize(sfa_mesh_arena *arena)
+{
+
+    arena->initialized = true;
+    arena->page_size = __sfa_virtual_size();
+    arena->page_count = SFA_MESH_ARENA_SIZE / arena->page_size;
+    if (arena->page_count >= UINT32_MAX) arena->page_count = UINT32_MAX - 1;
+
+    // The metadata is reserved in full as well and faulted in as spans are used.
+    uint64_t page_spans_size = arena->page_count * sizeof(uint32_t);
+    uint64_t spans_size = arena->page_count * sizeof(sfa_mesh_span);
+    arena->page_spans = (uint32_t*)__sfa_virtual_alloc(NULL, page_spans_size);
+    arena->spans = (sfa_mesh_span*)__sfa_virtual_alloc(NULL, spans_size);
+    arena->base = (uint8_t*)__sfa_mesh_arena_map(arena->page_count * arena->page_size, &arena->file);
+    if (arena->page_spans != NULL && arena->spans != NULL && arena->base != NULL && __sfa_mesh_fault_register())
+    {
+        __sfa_fork_register();
+        return true;
+    }
+
+    if (arena->base != NULL) __sfa_shared_memory_close(arena->file, arena->base, arena->page_count * arena->page_size);
+    if (arena->page_spans != NULL) __sfa_virtual_free(arena->page_spans, page_spans_size);
+    if (arena->spans != NULL) __sfa_virtual_free(arena->spans, spans_size);
+    arena->page_spans = NULL;
+    arena->spans = NULL;
+    arena->base = NULL;
+    return false;
+
+}
+
+static inline uint64_t
+__sfa_mesh_object_count(sfa_mesh_arena *arena, uint64_t class_index)
+{
+
+    uint64_t object_count = arena->page_size / SFA_SIZE_CLASS_SIZE(class_index);
+    return (object_count > 128) ? 128 : object_count;
+
+}
+
+static inline void
+__sfa_mesh_partial_insert(sfa_mesh_arena *arena, uint32_t span_index)
+{
+
+    sfa_mesh_span *span = &arena->spans[span_index];
+    uint32_t *head = &arena->partial_spans[span->class_index];
+    span->prev_span = 0;
+    span->next_span = *head;
+    if (*head != 0) arena->spans[*head - 1].prev_span = span_index + 1;
+    *head = span_index + 1;
+
+}
+
+static inline void
+__sfa_mesh_partial_remove(sfa_mesh_arena *arena, uint32_t span_index)
+{
+
+    sfa_mesh_span *span = &arena->spans[span_index];
+    if (span->prev_span != 0) arena->spans[span->prev_span - 1].next_span = span->next_span;
+    else arena->partial_spans[span->class_index] = span->next_span;
+    if (span->next_span != 0) arena->spans[span->next_span - 1].prev_span = span->prev_span;
+
+    span->next_span = 0;
+    span->prev_span = 0;
+
+}
+
+static inline uint32_t
+__sfa_mesh_create_span(sfa_mesh_arena *arena, uint64_t class_index)
+{
+
+    // Released pages first, then fresh ones. Returns the span index + 1.
+    uint32_t span_index = 0;
+    if (arena->free_pages != 0)
+    {
+        span_index = arena->free_pages - 1;
+        arena->free_pages = arena->spans[span_index].next_span;
+    }
+
+    else if (arena->page_cursor < arena->page_count)
+    {
+        span_index = (uint32_t)arena->page_cursor;
+        arena->page_cursor += 1;
+    }
+
+    else
+    {
+        return 0;
+    }
+
+    sfa_mesh_span *span = &arena->spans[span_index];
+    memset(span, 0, sizeof(sfa_mesh_span));
+    span->class_index = (uint32_t)class_index;
+    span->page_count = 1;
+    span->pages[0] = span_index;
+    arena->page_spans[span_index] = span_index + 1;
+    __sfa_mesh_partial_insert(arena, span_index);
+    return span_index + 1;
+
+}
+
+static inline void
+__sfa_mesh_release_span(sfa_mesh_arena *arena, uint32_t span_index)
+{
+
+    // The physical page goes back to the OS, and the virtual pages meshed onto it
+    // are mapped back onto their own physical pages before they are reused.
+    sfa_mesh_span *span = &arena->spans[span_index];
+    __sfa_mesh_partial_remove(arena, span_index);
+    __sfa_mesh_page_release(arena->file, (uint64_t)span_index * arena->page_size, arena->page_size);
+
+    for (uint32_t page_index = 0; page_index < span->page_count; ++page_index)
+    {
+
+        uint32_t page = span->pages[page_index];
+        uint64_t page_offset = (uint64_t)page * arena->page_size;
+        if (page != span_index)
+            __sfa_mesh_page_map(arena->base + page_offset, arena->file, page_offset, arena->page_size);
+
+        arena->page_spans[page] = 0;
+        arena->spans[page].next_span = arena->free_pages;
+        arena->free_pages = page + 1;
+
+    }
+
+    span->page_count = 0;
+
+}
+
+static inline bool
+__sfa_mesh_spans(sfa_mesh_arena *arena, uint32_t span_index, uint32_t other_index)
+{
+
+    sfa_mesh_span *span = &arena->spans[span_index];
+    sfa_mesh_span *other = &arena->spans[other_index];
+    if ((span->occupied[0] & other->occupied[0]) != 0 || (span->occupied[1] & other->occupied[1]) != 0)
+        return false;
+    if (span->page_count + other->page_count > SFA_MESH_MAXIMUM_PAGES)
+        return false;
+
+    // Writers to the other span are held off first, see the fault handler. Protecting
+    // can only fail once the process runs out of mappings, as can remapping, in which
+    // case every page is put back the way it was.
+    uint64_t span_offset = (uint64_t)span_index * arena->page_size;
+    uint64_t other_offset = (uint64_t)other_index * arena->page_size;
+    uint32_t protected_count = 0;
+    __atomic_store_n(&arena->is_meshing, 1, __ATOMIC_RELEASE);
+    while (protected_count < other->page_count)
+    {
+        uint8_t *page = arena->base + (uint64_t)other->pages[protected_count] * arena->page_size;
+        if (__sfa_mesh_page_protect(page, arena->page_size, false) == false) break;
+        protected_count += 1;
+    }
+
+    // Copy the other span's blocks over, then move every one of its virtual pages
+    // onto this span's physical page, which also makes them writable again.
+    uint32_t moved_count = 0;
+    if (protected_count == other->page_count)
+    {
+
+        uint64_t object_size = SFA_SIZE_CLASS_SIZE(span->class_index);
+        uint8_t *span_page = arena->base + span_offset;
+        uint8_t *other_page = arena->base + other_offset;
+        for (uint64_t object_index = 0; object_index < 128; ++object_index)
+        {
+            uint64_t object_offset = object_index * object_size;
+            if (other->occupied[object_index / 64] & ((uint64_t)1 << (object_index % 64)))
+                memcpy(span_page + object_offset, other_page + object_offset, object_size);
+        }
+
+        while (moved_count < other->page_count)
+        {
+            uint8_t *page = arena->base + (uint64_t)other->pages[moved_count] * arena->page_size;
+            if (__sfa_mesh_page_map(page, arena->file, span_offset, arena->page_size) == false) break;
+            moved_count += 1;
+        }
+
+    }
+
+    bool is_meshed = (moved_count == other->page_count);
+    for (uint32_t page_index = 0; !is_meshed && page_index < protected_count; ++page_index)
+    {
+        uint8_t *page = arena->base + (uint64_t)other->pages[page_index] * arena->page_size;
+        if (page_index < moved_count) __sfa_mesh_page_map(page, arena->file, other_offset, arena->page_size);
+        else __sfa_mesh_page_protect(page, arena->page_size, true);
+    }
+
+    __atomic_store_n(&arena->is_meshing, 0, __ATOMIC_RELEASE);
+    if (is_meshed == false) return false;
+
+    for (uint32_t page_index = 0; page_index < other->page_count; ++page_index)
+    {
+        arena->page_spans[other->pages[page_index]] = span_index + 1;
+        span->pages[span->page_count++] = other->pages[page_index];
+    }
+
+    span->occupied[0] |= other->occupied[0];
+    span->occupied[1] |= other->occupied[1];
+    span->occupied_count += other->occupied_count;
+    __sfa_mesh_partial_remove(arena, other_index);
+    __sfa_mesh_page_release(arena->file, other_offset, arena->page_size);
+    other->page_count = 0;
+    return true;
+
+}
+
+// --- Compaction --------------------------------------------------------------
+//
+// Compacting slides a movable block into the free block directly to its left, the
+// free space ends up behind the block and coallesces with whatever follows it. Over
+// repeated steps the free space of a pool collects in its tail. Blocks which aren't
+// movable, or whose handle is locked, stay put and the free space gathers in front
+// of them instead.
+//
+// A step that runs out of time saves the descriptor it stopped at, and the next one
+// picks up from there. Should that descriptor be coallesced away in the meantime,
+// the cursor falls back to the block which absorbed it.
+//
+
+static inline void
+__sfa_compact_absorb(sfa_state *state, sfa_allocation_descriptor *node, sfa_allocation_descriptor *survivor)
+{
+
+    if (state->compact_node == node) state->compact_node = survivor;
+
+}
+
+static inline sfa_handle_entry*
+__sfa_handle_entry(sfa_handle_table *table, sfa_handle handle)
+{
+
+    uint64_t entry_index = (handle & UINT32_MAX) - 1;
+    SFA_ASSERT(handle != 0 && entry_index < table->entry_count);
+    sfa_handle_entry *entry = &table->entries[entry_index];
+    SFA_ASSERT(entry->generation == (uint32_t)(handle >> 32) && entry->block_pointer != NULL);
+    return entry;
+
+}
+
+static inline sfa_handle
+__sfa_handle_create(sfa_handle_table *table, sfa_state *state, void *ptr)
+{
+
+    // The table is reserved in full on first use, and faulted in as it grows.
+    if (table->entries == NULL)
+    {
+        table->entries = (sfa_handle_entry*)__sfa_virtual_alloc(NULL,
+                SFA_HANDLE_MAXIMUM_COUNT * sizeof(sfa_handle_entry));
+        if (table->entries == NULL) return 0;
+    }
+
+    uint64_t entry_index = 0;
+    if (table->free_entries != 0)
+    {
+        entry_index = table->free_entries - 1;
+        table->free_entries = table->entries[entry_index].next_free;
+    }
+
+    else if (table->entry_count < SFA_HANDLE_MAXIMUM_COUNT)
+    {
+        entry_index = table->entry_count;
+        table->entry_count += 1;
+    }
+
+    else
+    {
+        return 0;
+    }
+
+    sfa_handle_entry *entry = &table->entries[entry_index];
+    entry->block_pointer = ptr;
+    entry->parent_state = state;
+    entry->lock_count = 0;
+    entry->next_free = 0;
+
+    sfa_allocation_descriptor *node = __sfa_get_descriptor(ptr);
+    node->flags.is_movable = true;
+    node->flags.handle_index = entry_index;
+    return ((uint64_t)entry->generation << 32) | (entry_index + 1);
+
+}
+
+static inline void
+__sfa_handle_release(sfa_handle_table *table, sfa_handle_entry *entry)
+{
+
+    // Bumping the generation invalidates every copy of the handle.
+    uint64_t entry_index = (uint64_t)(entry - table->entries);
+    entry->block_pointer = NULL;
+    entry->parent_state = NULL;
+    entry->generation += 1;
+    entry->next_free = table->free_entries;
+    table->free_entries = (uint32_t)entry_index + 1;
+
+}
+
+static inline sfa_allocation_descriptor*
+__sfa_compact_block(sfa_state *state, sfa_allocation_descriptor *node)
+{
+
+    // NOTE(Chris): Returns the free block left behind the moved block, or NULL when
+    //              the right neighbor can't be moved.
+    SFA_ASSERT(node->flags.is_occupied == false);
+    sfa_allocation_descriptor *right = node->right_descriptor;
+    if (right == NULL || right->flags.is_occupied == false || right->flags.is_movable == false)
+        return NULL;
+
+    uint64_t block_offset = __sfa_allocation_descriptor_size();
+    SFA_ASSERT(node->block_offset == block_offset && right->block_offset == block_offset);
+
+    sfa_handle_table *table = &sfa_global_handle_table;
+    __sfa_lock_acquire(&table->lock);
+    sfa_handle_entry *entry = &table->entries[right->flags.handle_index];
+    if (entry->lock_count > 0)
+    {
+        __sfa_lock_release(&table->lock);
+        return NULL;
+    }
+
+    // The moved data overwrites the old descriptor, so it's copied out first. The new
+    // descriptors land on memory that has either been moved already or was free.
+    sfa_pool_descriptor *pool = node->parent_pool;
+    sfa_allocation_descriptor moved = *right;
+    sfa_allocation_descriptor *left = node->left_descriptor;
+    uint64_t free_size = node->allocation_size;
+    __sfa_free_list_remove(pool, node);
+
+    uint8_t *block_begin = (uint8_t*)node;
+    memmove(block_begin + block_offset, moved.block_pointer, moved.allocation_size);
+
+    sfa_allocation_descriptor *moved_node = (sfa_allocation_descriptor*)block_begin;
+    sfa_allocation_descriptor *free_node = (sfa_allocation_descriptor*)(block_begin + block_offset + moved.allocation_size);
+    *moved_node = moved;
+    moved_node->left_descriptor = left;
+    moved_node->right_descriptor = free_node;
+    moved_node->block_pointer = block_begin + block_offset;
+    if (left != NULL) left->right_descriptor = moved_node;
+
+    free_node->flags.flags = 0;
+    free_node->flags.is_coallescable = true;
+    free_node->left_descriptor = moved_node;
+    free_node->right_descriptor = moved.right_descriptor;
+    free_node->parent_pool = pool;
+    free_node->block_pointer = (uint8_t*)free_node + block_offset;
+    free_node->block_offset = block_offset;
+    free_node->allocation_size = free_size;
+    free_node->free_time = (state->decay_time > 0) ? __sfa_time_milliseconds() : 0;
+    free_node->next_free = NULL;
+    free_node->prev_free = NULL;
+
+    entry->block_pointer = moved_node->block_pointer;
+    __sfa_lock_release(&table->lock);
+
+    // Coallesce with the right neighbor, absorbing it into the free block.
+    sfa_allocation_descriptor *next = free_node->right_descriptor;
+    if (next != NULL && next->flags.is_occupied == false)
+    {
+
+        __sfa_free_list_remove(pool, next);
+        free_node->allocation_size += next->block_offset + next->allocation_size;
+        free_node->right_descriptor = next->right_descriptor;
+        next = next->right_descriptor;
+
+    }
+
+    if (next != NULL) next->left_descriptor = free_node;
+    __sfa_free_list_insert(pool, free_node);
+    return free_node;
+
+}
+
+static inline bool
+__sfa_compact_pool(sfa_state *state, sfa_pool_descriptor *pool, uint64_t deadline, uint64_t *moved_size)
+{
+
+    // Returns false once the deadline passes, with the descriptor to resume at saved.
+    sfa_allocation_descriptor *node = (state->compact_pool == pool && state->compact_node != NULL) ?
+        state->compact_node : (sfa_allocation_descriptor*)pool->memory_region;
+    state->compact_pool = NULL;
+    state->compact_node = NULL;
+
+    uint64_t visited_count = 0;
+    while (node != NULL)
+    {
+
+        sfa_allocation_descriptor *free_node = (node->flags.is_occupied == false) ?
+            __sfa_compact_block(state, node) : NULL;
+        if (free_node != NULL) *moved_size += free_node->left_descriptor->allocation_size;
+        node = (free_node != NULL) ? free_node : node->right_descriptor;
+
+        visited_count += 1;
+        bool is_checked = (free_node != NULL || visited_count % SFA_COMPACT_CLOCK_INTERVAL == 0);
+        if (node != NULL && is_checked && __sfa_time_microseconds() >= deadline)
+        {
+            state->compact_pool = pool;
+            state->compact_node = node;
+            return false;
+        }
+
+    }
+
+    return true;
+
+}
+
+// --- Lifetimes ---------------------------------------------------------------
+//
+// Each lifetime has its own heap, and with it its own pools. Packed permanent
+// allocations are carved out of chunks which are themselves blocks of the permanent
+// heap, the chunks are never freed.
+//
+
+static inline sfa_state*
+__sfa_lifetime_heap(sfa_lifetime_heaps *lifetimes, uint64_t lifetime)
+{
+
+    // NOTE(Chris): The lifetime heaps are created on first use and never destroyed,
+    //              the lock comes before the default heap's and the registry's.
+    sfa_state **heap = (lifetime == SFA_LIFETIME_LONG) ? &lifetimes->long_heap : &lifetimes->permanent_heap;
+    __sfa_lock_acquire(&lifetimes->lock);
+    if (*heap == NULL) *heap = sf_heap_create(SFA_DEFAULT_INITIAL_POOL_SIZE);
+    sfa_state *state = *heap;
+    __sfa_lock_release(&lifetimes->lock);
+    return state;
+
+}
+
+static inline void*
+__sfa_permanent_alloc(sfa_lifetime_heaps *lifetimes, sfa_state *state, uint64_t size)
+{
+
+    // The unused end of a chunk is abandoned once a request no longer fits, which
+    // wastes at most a quarter of the chunk. Chunks start aligned, and every request
+    // is rounded up so that the next one stays aligned as well.
+    uint64_t packed_size = (size + SFA_ALLOCATION_ALIGNMENT_SIZE - 1) & ~(SFA_ALLOCATION_ALIGNMENT_SIZE - 1);
+    if (packed_size == 0) packed_size = SFA_ALLOCATION_ALIGNMENT_SIZE;
+
+    uint64_t required_size = __sfa_request_size_to_minimum_alloc_size(packed_size);
+    uint64_t chunk_size = __sfa_request_size_to_nearest_boundary(SFA_PERMANENT_CHUNK_SIZE);
+    if (packed_size > chunk_size / 4)
+        return __sfa_alloc_block(state, __sfa_request_size_to_nearest_boundary(required_size));
+
+    if ((uint64_t)(lifetimes->permanent_end - lifetimes->permanent_cursor) < packed_size)
+    {
+
+        uint8_t *chunk = (uint8_t*)__sfa_alloc_block(state, chunk_size);
+        if (chunk == NULL) return NULL;
+        lifetimes->permanent_cursor = chunk;
+        lifetimes->permanent_end = chunk + chunk_size;
+
+    }
+
+    void *user_ptr = lifetimes->permanent_cursor;
+    lifetimes->permanent_cursor += packed_size;
+    return user_ptr;
+
+}
+
+// --- Thread Cache ------------------------------------------------------------
+//
+// Small allocations of the default heap are served from a per-thread cache of
+// recently freed blocks, binned by size class. Pops and pushes never touch the
+// heap lock, the lock is only taken to fill an empty bin (a regular allocation)
+// or to return half of a full bin to the heap in one go.
+//
+// When a thread exits, its cache is returned to the heap. Any block freed by
+// the thread after that point bypasses the cache.
+//
+
+static inline uint64_t
+__sfa_thread_cache_class(uint64_t size)
+{
+
+    // The size must already be rounded to the allocation alignment.
+    return (size / SFA_ALLOCATION_ALIGNMENT_SIZE) - 1;
+
+}
+
+static inline sfa_thread_cache*
+__sfa_get_thread_cache()
+{
+
+    sfa_thread_cache *cache = &sfa_thread_cache_state;
+    if (cache->is_registered == false)
+    {
+        cache->is_registered = true;
+        __sfa_thread_cache_register(cache);
+    }
+
+    return cache;
+
+}
+
+static inline void
+__sfa_thread_cache_flush(sfa_thread_cache *cache, uint64_t class_index, uint32_t count)
+{
+
+    sfa_state *state = __sfa_get_state();
+    __sfa_lock_acquire(&state->lock);
+
+    if (cache->pressure_epoch != state->pressure_epoch)
+        __sfa_thread_cache_drain(state, cache);
+
+    while (count > 0 && cache->bins[class_index] != NULL)
+    {
+
+        void *ptr = cache->bins[class_index];
+        cache->bins[class_index] = *(void**)ptr;
+        cache->counts[class_index] -= 1;
+        count -= 1;
+
+        __sfa_free_block(state, __sfa_get_descriptor(ptr));
+
+    }
+
+    __sfa_lock_release(&state->lock);
+
+}
+
+static inline void
+__sfa_thread_cache_drain(sfa_state *state, sfa_thread_cache *cache)
+{
+
+    // Returns every cached block to the heap, the caller holds the heap lock.
+    for (uint64_t class_index = 0; class_index < SFA_THREAD_CACHE_CLASS_COUNT; ++class_index)
+    {
+
+        while (cache->bins[class_index] != NULL)
+        {
+            void *ptr = cache->bins[class_index];
+            cache->bins[class_index] = *(void**)ptr;
+            __sfa_free_block(state, __sfa_get_descriptor(ptr));
+        }
+
+        cache->counts[class_index] = 0;
+
+    }
+
+    cache->pressure_epoch = state->pressure_epoch;
+
+}
+
+static void
+__sfa_thread_cache_release(void *cache)
+{
+
+    sfa_thread_cache *thread_cache = (sfa_thread_cache*)cache;
+    thread_cache->is_released = true;
+
+    for (uint64_t class_index = 0; class_index < SFA_THREAD_CACHE_CLASS_COUNT; ++class_index)
+    {
+
+        if (thread_cache->counts[class_index] > 0)
+            __sfa_thread_cache_flush(thread_cache, class_index, thread_cache->counts[class_index]);
+
+    }
+
+}
+
+static inline void*
+__sfa_thread_cache_pop(uint64_t class_index)
+{
+
+    SFA_ASSERT(class_index < SFA_THREAD_CACHE_CLASS_COUNT);
+
+    sfa_thread_cache *cache = &sfa_thread_cache_state;
+    void *ptr = cache->bins[class_index];
+    if (ptr == NULL) return NULL;
+
+    cache->bins[class_index] = *(void**)ptr;
+    cache->counts[class_index] -= 1;
+    return ptr;
+
+}
+
+static inline void*
+__sfa_thread_cache_refill(uint64_t class_index)
+{
+
+    // Allocates a handful of blocks under a single lock acquisition, one is given
+    // to the caller and the remaining are placed into the bin.
+    sfa_state *state = __sfa_get_heap_state(NULL);
+    sfa_thread_cache *cache = __sfa_get_thread_cache();
+    uint32_t refill_count = (cache->is_released) ? 1 : SFA_THREAD_CACHE_REFILL;
+    uint64_t block = SFA_SIZE_CLASS_SIZE(class_index);
+
+    __sfa_lock_acquire(&state->lock);
+
+    if (cache->pressure_epoch != state->pressure_epoch)
+        __sfa_thread_cache_drain(state, cache);
+
+    void *user_ptr = __sfa_alloc_block(state, block);
+    for (uint32_t index = 1; index < refill_count && user_ptr != NULL; ++index)
+    {
+
+        void *cached_ptr = __sfa_alloc_block(state, block);
+        if (cached_ptr == NULL) break;
+
+        *(void**)cached_ptr = cache->bins[class_index];
+        cache->bins[class_index] = cached_ptr;
+        cache->counts[class_index] += 1;
+
+    }
+
+    __sfa_release_state(state);
+    return user_ptr;
+
+}
+
+static inline bool
+__sfa_thread_cache_push(void *ptr, uint64_t class_index)
+{
+
+    // The block is binned by the class it was requested as, not of the block itself,
+    // which may be larger. Any class a block is placed in is guaranteed to fit in it.
+    SFA_ASSERT(class_index < SFA_THREAD_CACHE_CLASS_COUNT);
+
+    sfa_thread_cache *cache = __sfa_get_thread_cache();
+    if (cache->is_released) return false;
+
+    if (cache->counts[class_index] >= SFA_THREAD_CACHE_DEPTH)
+        __sfa_thread_cache_flush(cache, class_index, SFA_THREAD_CACHE_DEPTH / 2);
+
+    *(void**)ptr = cache->bins[class_index];
+    cache->bins[class_index] = ptr;
+    cache->counts[class_index] += 1;
+    return true;
+
+}
+
+// --- Win32 Definitions -------------------------------------------------------
+//
+// The following definitions defined the required OS-specific internal API methods.
+// Most of these functions are simply wrappers for the OS-equivelant calls and have
+// little overhead (aside from the OS call itself).
+//
+
+#if defined (_WIN32)
+
+static inline void*
+__sfa_virtual_alloc(void* offset, uint64_t size)
+{
+
+    void* buffer = VirtualAlloc(offset, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    return buffer;
+
+}
+
+static inline void*
+__sfa_virtual_alloc_huge(uint64_t size, bool use_hugetlb)
+{
+
+    // Windows only has explicit large pages, which require SeLockMemoryPrivilege.
+    // Without it, the pool falls back to regular pages.
+    (void)use_hugetlb;
+    uint64_t large_page_size = (uint64_t)GetLargePageMinimum();
+    if (large_page_size != 0)
+    {
+
+        uint64_t large_size = (size + large_page_size - 1) & ~(large_page_size - 1);
+        void* buffer = VirtualAlloc(NULL, large_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (buffer != NULL) return buffer;
+
+    }
+
+    return __sfa_virtual_alloc(NULL, size);
+
+}
+
+static inline void
+__sfa_virtual_free(void* ptr, uint64_t size)
+{
+
+    SFA_ASSERT_POINTER(ptr);
+    VirtualFree(ptr, 0, MEM_RELEASE);
+
+}
+
+static inline bool
+__sfa_virtual_purge(void* ptr, uint64_t size)
+{
+
+    // The pages remain committed, but their contents may be discarded.
+    return VirtualAlloc(ptr, size, MEM_RESET, PAGE_READWRITE) != NULL;
+
+}
+
+static inline void
+__sfa_virtual_prefault(void* ptr, uint64_t size)
+{
+
+    // An interlocked or of zero is a write fault which leaves the contents as is.
+    uint64_t page_size = __sfa_virtual_size();
+    for (uint64_t offset = 0; offset < size; offset += page_size)
+        InterlockedOr8((char volatile*)((uint8_t*)ptr + offset), 0);
+
+}
+
+static inline int32_t
+__sfa_virtual_lock(void* ptr, uint64_t size)
+{
+
+    if (VirtualLock(ptr, size) != 0) return 0;
+    return (int32_t)GetLastError();
+
+}
+
+static inline uint64_t
+__sfa_virtual_lock_limit()
+{
+
+    SIZE_T minimum_size = 0;
+    SIZE_T maximum_size = 0;
+    if (GetProcessWorkingSetSize(GetCurrentProcess(), &minimum_size, &maximum_size) == 0) return 0;
+    return (uint64_t)maximum_size;
+
+}
+
+static inline void
+__sfa_virtual_unlock(void* ptr, uint64_t size)
+{
+
+    VirtualUnlock(ptr, size);
+
+}
+
+static inline uint64_t
+__sfa_processor_count()
+{
+
+    SYSTEM_INFO system_info = {0};
+    GetSystemInfo(&system_info);
+    return (uint64_t)system_info.dwNumberOfProcessors;
+
+}
+
+static inline uint64_t
+__sfa_virtual_size()
+{
+
+    // Cache this value, it never changes.
+    static uint64_t page_granularity = 0;
+    if (page_granularity == 0)
+    {
+
+        SYSTEM_INFO system_info = {0};
+        GetSystemInfo(&system_info);
+        page_granularity = system_info.dwAllocationGranularity;
+
+    }
+
+    return page_granularity;
+
+}
+
+static inline void
+__sfa_lock_init(sfa_lock *lock)
+{
+
+    InitializeSRWLock(lock);
+
+}
+
+static inline void
+__sfa_lock_destroy(sfa_lock *lock)
+{
+
+    // Slim reader/writer locks hold no resources.
+    (void)lock;
+
+}
+
+static void WINAPI
+__sfa_thread_cache_release_callback(void *cache)
+{
+
+    if (cache != NULL) __sfa_thread_cache_release(cache);
+
+}
+
+static inline void
+__sfa_thread_cache_register(sfa_thread_cache *cache)
+{
+
+    // Fiber local storage callbacks are invoked on thread exit, unlike TLS slots.
+    static INIT_ONCE init_once = INIT_ONCE_STATIC_INIT;
+    static DWORD fls_index = FLS_OUT_OF_INDEXES;
+    BOOL pending = FALSE;
+    if (InitOnceBeginInitialize(&init_once, 0, &pending, NULL) && pending)
+    {
+        fls_index = FlsAlloc(__sfa_thread_cache_release_callback);
+        InitOnceComplete(&init_once, 0, NULL);
+    }
+
+    if (fls_index != FLS_OUT_OF_INDEXES) FlsSetValue(fls_index, cache);
+
+}
+
+static inline void
+__sfa_lock_acquire(sfa_lock *lock)
+{
+
+    AcquireSRWLockExclusive(lock);
+
+}
+
+static inline void
+__sfa_lock_release(sfa_lock *lock)
+{
+
+    ReleaseSRWLockExclusive(lock);
+
+}
+
+static inline void
+__sfa_condition_wait(sfa_condition *condition, sfa_lock *lock, uint64_t milliseconds)
+{
+
+    SleepConditionVariableSRW(condition, lock, (DWORD)milliseconds, 0);
+
+}
+
+static inline void
+__sfa_condition_signal(sfa_condition *condition)
+{
+
+    WakeConditionVariable(condition);
+
+}
+
+static DWORD WINAPI
+__sfa_thread_entry(LPVOID routine)
+{
+
+    ((void (*)(void))routine)();
+    return 0;
+
+}
+
+static inline bool
+__sfa_thread_create(sfa_thread *thread, void (*routine)(void))
+{
+
+    *thread = CreateThread(NULL, 0, __sfa_thread_entry, (LPVOID)routine, 0, NULL);
+    return *thread != NULL;
+
+}
+
+static inline void
+__sfa_thread_join(sfa_thread thread)
+{
+
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+
+}
+
+static inline uint64_t
+__sfa_time_milliseconds()
+{
+
+    return (uint64_t)GetTickCount64();
+
+}
+
+static inline uint64_t
+__sfa_time_microseconds()
+{
+
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+        (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000 / (uint64_t)frequency.QuadPart;
+
+}
+
+static inline void
+__sfa_fork_register()
+{
+
+}
+
+static inline int64_t
+__sfa_process_fork()
+{
+
+    return -1;
+
+}
+
+static inline void
+__sfa_process_exit(bool success)
+{
+
+    ExitProcess((success) ? 0 : 1);
+
+}
+
+static inline bool
+__sfa_process_wait(int64_t process)
+{
+
+    (void)process;
+    return false;
+
+}
+
+static inline void*
+__sfa_mesh_arena_map(uint64_t size, int *file)
+{
+
+    (void)size;
+    *file = -1;
+    return NULL;
+
+}
+
+static inline bool
+__sfa_mesh_page_map(void *page, int file, uint64_t file_offset, uint64_t size)
+{
+
+    (void)page;
+    (void)file;
+    (void)file_offset;
+    (void)size;
+    return false;
+
+}
+
+static inline void
+__sfa_mesh_page_release(int file, uint64_t file_offset, uint64_t size)
+{
+
+    (void)file;
+    (void)file_offset;
+    (void)size;
+
+}
+
+static inline bool
+__sfa_mesh_page_protect(void *page, uint64_t size, bool is_writable)
+{
+
+    (void)page;
+    (void)size;
+    (void)is_writable;
+    return false;
+
+}
+
+static inline bool
+__sfa_mesh_fault_register()
+{
+
+    return false;
+
+}
+
+static inline uint64_t
+__sfa_memory_limit()
+{
+
+    // Processes in a job object with a memory limit are the equivalent of a cgroup.
+    static bool is_cached = false;
+    static uint64_t memory_limit = 0;
+    if (is_cached == false)
+    {
+
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION limit_information = {0};
+        if (QueryInformationJobObject(NULL, JobObjectExtendedLimitInformation,
+                &limit_information, sizeof(limit_information), NULL))
+        {
+            DWORD limit_flags = limit_information.BasicLimitInformation.LimitFlags;
+            if (limit_flags & JOB_OBJECT_LIMIT_JOB_MEMORY)
+                memory_limit = (uint64_t)limit_information.JobMemoryLimit;
+            else if (limit_flags & JOB_OBJECT_LIMIT_PROCESS_MEMORY)
+                memory_limit = (uint64_t)limit_information.ProcessMemoryLimit;
+        }
+
+        is_cached = true;
+
+    }
+
+    return memory_limit;
+
+}
+
+static inline bool
+__sfa_pressure_monitor_start(uint64_t stall_microseconds, uint64_t window_microseconds)
+{
+
+    (void)stall_microseconds;
+    (void)window_microseconds;
+    return false;
+
+}
+
+static inline void
+__sfa_pressure_monitor_stop()
+{
+
+}
+
+static inline int
+__sfa_shared_memory_open(const char *name, bool create)
+{
+
+    // Shared heaps need a process-shared lock, which SRW locks can't provide.
+    (void)name;
+    (void)create;
+    return -1;
+
+}
+
+static inline int
+__sfa_shared_memory_anonymous()
+{
+
+    return -1;
+
+}
+
+static inline int
+__sfa_shared_file_open(const char *path, bool create)
+{
+
+    (void)path;
+    (void)create;
+    return -1;
+
+}
+
+static inline void
+__sfa_shared_file_remove(const char *path)
+{
+
+    (void)path;
+
+}
+
+static inline bool
+__sfa_shared_memory_sync(void *ptr, uint64_t size)
+{
+
+    (void)ptr;
+    (void)size;
+    return false;
+
+}
+
+static inline void*
+__sfa_shared_memory_map(int file, uint64_t *size, bool create)
+{
+
+    (void)file;
+    (void)size;
+    (void)create;
+    return NULL;
+
+}
+
+static inline void
+__sfa_shared_memory_close(int file, void *ptr, uint64_t size)
+{
+
+    (void)file;
+    (void)ptr;
+    (void)size;
+
+}
+
+static inline bool
+__sfa_shared_memory_unlink(const char *name)
+{
+
+    (void)name;
+    return false;
+
+}
+
+static inline bool
+__sfa_shared_lock_init(sfa_lock *lock)
+{
+
+    (void)lock;
+    return false;
+
+}
+
+static inline void
+__sfa_shared_lock_acquire(sfa_lock *lock)
+{
+
+    __sfa_lock_acquire(lock);
+
+}
+
+// --- POSIX Definitions -------------------------------------------------------
+//
+// The POSIX equivalents of the above. Pools are anonymous private mappings.
+//
+
+#else
+
+static inline void*
+__sfa_virtual_alloc(void* offset, uint64_t size)
+{
+
+    void* buffer = mmap(offset, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (buffer == MAP_FAILED) ? NULL : buffer;
+
+}
+
+static inline void*
+__sfa_virtual_alloc_huge(uint64_t size, bool use_hugetlb)
+{
+
+    // Explicit huge pages come pre-aligned, but fail if the hugetlbfs reservation is
+    // exhausted, in which case we fall back to transparent huge pages.
+#if defined (MAP_HUGETLB) && defined (MAP_HUGE_SHIFT)
+    if (use_hugetlb)
+    {
+
+        int huge_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+        void* buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, huge_flags, -1, 0);
+        if (buffer != MAP_FAILED) return buffer;
+
+    }
+#else
+    (void)use_hugetlb;
+#endif
+
+    // Over-reserve by a huge page and trim either end so the pool starts on a huge
+    // page boundary, otherwise the kernel can't back its first and last pages with
+    // huge pages.
+    uint64_t padded_size = size + SFA_HUGE_PAGE_SIZE;
+    void* buffer = mmap(NULL, padded_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) return NULL;
+
+    uint64_t buffer_begin = (uint64_t)buffer;
+    uint64_t aligned_begin = (buffer_begin + SFA_HUGE_PAGE_SIZE - 1) & ~(SFA_HUGE_PAGE_SIZE - 1);
+    uint64_t leading_size = aligned_begin - buffer_begin;
+    uint64_t trailing_size = padded_size - leading_size - size;
+    if (leading_size > 0) munmap(buffer, leading_size);
+    if (trailing_size > 0) munmap((void*)(aligned_begin + size), trailing_size);
+
+#if defined (MADV_HUGEPAGE)
+    madvise((void*)aligned_begin, size, MADV_HUGEPAGE);
+#endif
+
+    return (void*)aligned_begin;
+
+}
+
+static inline void
+__sfa_virtual_free(void* ptr, uint64_t size)
+{
+
+    SFA_ASSERT_POINTER(ptr);
+    munmap(ptr, size);
+
+}
+
+static inline void
+__sfa_virtual_prefault(void* ptr, uint64_t size)
+{
+
+    // Populating write faults in every page without touching its contents, older
+    // kernels fall back to an atomic or of zero into each page.
+#if defined (MADV_POPULATE_WRITE)
+    if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0) return;
+#endif
+
+    uint64_t page_size = __sfa_virtual_size();
+    for (uint64_t offset = 0; offset < size; offset += page_size)
+        __atomic_fetch_or((uint8_t*)ptr + offset, 0, __ATOMIC_RELAXED);
+
+}
+
+static inline int32_t
+__sfa_virtual_lock(void* ptr, uint64_t size)
+{
+
+    return (mlock(ptr, size) == 0) ? 0 : (int32_t)errno;
+
+}
+
+static inline uint64_t
+__sfa_virtual_lock_limit()
+{
+
+    struct rlimit lock_limit;
+    if (getrlimit(RLIMIT_MEMLOCK, &lock_limit) != 0) return 0;
+    if (lock_limit.rlim_cur == RLIM_INFINITY) return UINT64_MAX;
+    return (uint64_t)lock_limit.rlim_cur;
+
+}
+
+static inline void
+__sfa_virtual_unlock(void* ptr, uint64_t size)
+{
+
+    munlock(ptr, size);
+
+}
+
+static inline uint64_t
+__sfa_processor_count()
+{
+
+    long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (processor_count > 0) ? (uint64_t)processor_count : 1;
+
+}
+
+static inline bool
+__sfa_virtual_purge(void* ptr, uint64_t size)
+{
+
+#if defined (SFA_PURGE_LAZY) && defined (MADV_FREE)
+    if (madvise(ptr, size, MADV_FREE) == 0) return true;
+#endif
+    return madvise(ptr, size, MADV_DONTNEED) == 0;
+
+}
+
+static inline uint64_t
+__sfa_virtual_size()
+{
+
+    // Cache this value, it never changes.
+    static uint64_t page_granularity = 0;
+    if (page_granularity == 0)
+    {
+
+        page_granularity = (uint64_t)sysconf(_SC_PAGESIZE);
+
+    }
+
+    return page_granularity;
+
+}
+
+static inline void
+__sfa_lock_init(sfa_lock *lock)
+{
+
+    pthread_mutex_init(lock, NULL);
+
+}
+
+static inline void
+__sfa_lock_destroy(sfa_lock *lock)
+{
+
+    pthread_mutex_destroy(lock);
+
+}
+
+static pthread_key_t    sfa_thread_cache_key;
+static pthread_once_t   sfa_thread_cache_key_once = PTHREAD_ONCE_INIT;
+
+static void
+__sfa_thread_cache_create_key()
+{
+
+    pthread_key_create(&sfa_thread_cache_key, __sfa_thread_cache_release);
+
+}
+
+static inline void
+__sfa_thread_cache_register(sfa_thread_cache *cache)
+{
+
+    // Key destructors are invoked on thread exit with the non-NULL value.
+    pthread_once(&sfa_thread_cache_key_once, __sfa_thread_cache_create_key);
+    pthread_setspecific(sfa_thread_cache_key, cache);
+
+}
+
+static inline void
+__sfa_lock_acquire(sfa_lock *lock)
+{
+
+    pthread_mutex_lock(lock);
+
+}
+
+static inline void
+__sfa_lock_release(sfa_lock *lock)
+{
+
+    pthread_mutex_unlock(lock);
+
+}
+
+static inline void
+__sfa_condition_wait(sfa_condition *condition, sfa_lock *lock, uint64_t milliseconds)
+{
+
+    // Statically initialized conditions wait against the realtime clock.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t nanoseconds = (uint64_t)deadline.tv_nsec + (milliseconds % 1000) * 1000000;
+    deadline.tv_sec += (time_t)(milliseconds / 1000 + nanoseconds / 1000000000);
+    deadline.tv_nsec = (long)(nanoseconds % 1000000000);
+    pthread_cond_timedwait(condition, lock, &deadline);
+
+}
+
+static inline void
+__sfa_condition_signal(sfa_condition *condition)
+{
+
+    pthread_cond_signal(condition);
+
+}
+
+static void*
+__sfa_thread_entry(void *routine)
+{
+
+    ((void (*)(void))routine)();
+    return NULL;
+
+}
+
+static inline bool
+__sfa_thread_create(sfa_thread *thread, void (*routine)(void))
+{
+
+    return pthread_create(thread, NULL, __sfa_thread_entry, (void*)routine) == 0;
+
+}
+
+static inline void
+__sfa_thread_join(sfa_thread thread)
+{
+
+    pthread_join(thread, NULL);
+
+}
+
+static inline uint64_t
+__sfa_time_milliseconds()
+{
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+
+}
+
+static inline uint64_t
+__sfa_time_microseconds()
+{
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+
+}
+
+static pthread_once_t   sfa_fork_register_once = PTHREAD_ONCE_INIT;
+
+static void
+__sfa_fork_register_handlers()
+{
+
+    pthread_atfork(__sfa_fork_prepare, __sfa_fork_parent, __sfa_fork_child);
+
+}
+
+static inline void
+__sfa_fork_register()
+{
+
+    pthread_once(&sfa_fork_register_once, __sfa_fork_register_handlers);
+
+}
+
+static inline int64_t
+__sfa_process_fork()
+{
+
+    return (int64_t)fork();
+
+}
+
+static inline void
+__sfa_process_exit(bool success)
+{
+
+    _exit((success) ? 0 : 1);
+
+}
+
+static inline bool
+__sfa_process_wait(int64_t process)
+{
+
+    int status = 0;
+    while (waitpid((pid_t)process, &status, 0) < 0)
+    {
+        if (errno != EINTR) return false;
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+}
+
+static inline int
+__sfa_shared_memory_open(const char *name, bool create)
+{
+
+    // Anonymous shared memory is only reachable through the descriptor itself.
+    if (name == NULL) return (create) ? __sfa_shared_memory_anonymous() : -1;
+    return shm_open(name, O_RDWR | ((create) ? O_CREAT | O_EXCL : 0), 0600);
+
+}
+
+static inline int
+__sfa_shared_file_open(const char *path, bool create)
+{
+
+    // Images are held exclusively for as long as they are open.
+    int file = open(path, O_RDWR | O_CLOEXEC | ((create) ? O_CREAT | O_EXCL : 0), 0600);
+    if (file >= 0 && flock(file, LOCK_EX | LOCK_NB) != 0)
+    {
+        close(file);
+        return -1;
+    }
+
+    return file;
+
+}
+
+static inline void
+__sfa_shared_file_remove(const char *path)
+{
+
+    unlink(path);
+
+}
+
+static inline bool
+__sfa_shared_memory_sync(void *ptr, uint64_t size)
+{
+
+    return msync(ptr, size, MS_SYNC) == 0;
+
+}
+
+static inline void*
+__sfa_shared_memory_map(int file, uint64_t *size, bool create)
+{
+
+    // Created memory is sized here, opened memory reports its size instead.
+    struct stat file_stat;
+    if (create && ftruncate(file, (off_t)*size) != 0) return NULL;
+    if (!create && fstat(file, &file_stat) != 0) return NULL;
+    if (!create) *size = (uint64_t)file_stat.st_size;
+
+    void* buffer = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    return (buffer == MAP_FAILED) ? NULL : buffer;
+
+}
+
+static inline void
+__sfa_shared_memory_close(int file, void *ptr, uint64_t size)
+{
+
+    if (ptr != NULL) munmap(ptr, size);
+    close(file);
+
+}
+
+static inline bool
+__sfa_shared_memory_unlink(const char *name)
+{
+
+    return shm_unlink(name) == 0;
+
+}
+
+static inline bool
+__sfa_shared_lock_init(sfa_lock *lock)
+{
+
+    // Robust where available, so that a process dying while it holds the lock
+    // doesn't stall every other process.
+    pthread_mutexattr_t attributes;
+    if (pthread_mutexattr_init(&attributes) != 0) return false;
+    bool is_initialized = pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED) == 0;
+#if !defined (__APPLE__)
+    is_initialized = is_initialized && pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST) == 0;
+#endif
+    is_initialized = is_initialized && pthread_mutex_init(lock, &attributes) == 0;
+    pthread_mutexattr_destroy(&attributes);
+    return is_initialized;
+
+}
+
+static inline void
+__sfa_shared_lock_acquire(sfa_lock *lock)
+{
+
+    // NOTE(Chris): The previous owner died holding the lock. Whatever it was doing
+    //              to the heap may be half done, but the rest carry on regardless.
+    int result = pthread_mutex_lock(lock);
+#if !defined (__APPLE__)
+    if (result == EOWNERDEAD) pthread_mutex_consistent(lock);
+#else
+    (void)result;
+#endif
+
+}
+
+// --- Linux Definitions -------------------------------------------------------
+//
+// Memory limits come from cgroup v2 and pressure from the kernel's pressure stall
+// information. Both are read with plain file descriptors, since this may run from
+// within the very first malloc of the process.
+//
+
+#if defined (__linux__)
+
+static int sfa_pressure_monitor_fd = -1;
+static int sfa_pressure_monitor_wake_fds[2] = { -1, -1 };
+
+static inline void __sfa_pressure_monitor_close();
+
+static inline uint64_t
+__sfa_read_file(const char *path, char *buffer, uint64_t buffer_size)
+{
+
+    // Reads the whole file, one that fills the buffer counts as unreadable rather
+    // than being parsed cut short. The last byte is kept for the terminator.
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file < 0) return 0;
+
+    uint64_t capacity = buffer_size - 1;
+    uint64_t length = 0;
+    while (length < capacity)
+    {
+
+        ssize_t read_size = read(file, buffer + length, capacity - length);
+        if (read_size < 0 && errno == EINTR) continue;
+        if (read_size <= 0) break;
+        length += (uint64_t)read_size;
+
+    }
+
+    close(file);
+    if (length == capacity) length = 0;
+    buffer[length] = '\0';
+    return length;
+
+}
+
+static inline uint64_t
+__sfa_memory_limit()
+{
+
+    // The effective limit is the smallest memory.max from the process's cgroup up
+    // to the root, "max" meaning no limit at that level.
+    static bool is_cached = false;
+    static uint64_t memory_limit = 0;
+    if (is_cached == false)
+    {
+
+        char cgroup[4096];
+        char path[4096];
+        char limit[32];
+        if (__sfa_read_file("/proc/self/cgroup", cgroup, sizeof(cgroup)) > 0)
+        {
+
+            // Only the unified hierarchy has an entry for hierarchy ID zero.
+            char *cgroup_path = strstr(cgroup, "0::/");
+            if (cgroup_path == cgroup || (cgroup_path != NULL && cgroup_path[-1] == '\n'))
+            {
+
+                cgroup_path += 3;
+                char *line_end = strchr(cgroup_path, '\n');
+                if (line_end != NULL) *line_end = '\0';
+
+                uint64_t path_length = strlen(cgroup_path);
+                while (path_length > 1)
+                {
+
+                    int length = snprintf(path, sizeof(path), "/sys/fs/cgroup%.*s/memory.max", (int)path_length, cgroup_path);
+                    bool is_complete = (length > 0 && (uint64_t)length < sizeof(path));
+                    if (is_complete && __sfa_read_file(path, limit, sizeof(limit)) > 0 && limit[0] >= '0' && limit[0] <= '9')
+                    {
+                        uint64_t level_limit = strtoull(limit, NULL, 10);
+                        if (memory_limit == 0 || level_limit < memory_limit) memory_limit = level_limit;
+                    }
+
+                    while (path_length > 1 && cgroup_path[path_length - 1] != '/') path_length -= 1;
+                    if (path_length > 1) path_length -= 1;
+
+                }
+
+            }
+
+        }
+
+        is_cached = true;
+
+    }
+
+    return memory_limit;
+
+}
+
+static void
+__sfa_pressure_monitor_thread()
+{
+
+    struct pollfd poll_fds[2];
+    poll_fds[0].fd = sfa_pressure_monitor_fd;
+    poll_fds[0].events = POLLPRI;
+    poll_fds[1].fd = sfa_pressure_monitor_wake_fds[0];
+    poll_fds[1].events = POLLIN;
+
+    for (;;)
+    {
+
+        if (poll(poll_fds, 2, -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (poll_fds[1].revents != 0) break;
+        if (poll_fds[0].revents & POLLERR) break;
+        if (poll_fds[0].revents & POLLPRI) __sfa_relieve_pressure();
+
+    }
+
+}
+
+static inline bool
+__sfa_pressure_monitor_start(uint64_t stall_microseconds, uint64_t window_microseconds)
+{
+
+    // Unprivileged processes may only use windows in multiples of two seconds.
+    char trigger[64];
+    int trigger_length = snprintf(trigger, sizeof(trigger), "some %llu %llu",
+            (unsigned long long)stall_microseconds, (unsigned long long)window_microseconds);
+
+    sfa_pressure_monitor_fd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (sfa_pressure_monitor_fd < 0) return false;
+
+    if (write(sfa_pressure_monitor_fd, trigger, (size_t)trigger_length + 1) < 0 ||
+        pipe(sfa_pressure_monitor_wake_fds) != 0)
+    {
+        close(sfa_pressure_monitor_fd);
+        sfa_pressure_monitor_fd = -1;
+        return false;
+    }
+
+    sfa_registry *registry = &sfa_global_registry;
+    if (__sfa_thread_create(&registry->pressure_monitor_thread, __sfa_pressure_monitor_thread))
+        return true;
+
+    __sfa_pressure_monitor_close();
+    return false;
+
+}
+
+static inline void
+__sfa_pressure_monitor_stop()
+{
+
+    // Closing the wake pipe's write end hangs up the read end, which ends the thread's
+    // poll and can't fail the way a write could. The thread is always joined.
+    close(sfa_pressure_monitor_wake_fds[1]);
+    sfa_pressure_monitor_wake_fds[1] = -1;
+    __sfa_thread_join(sfa_global_registry.pressure_monitor_thread);
+    __sfa_pressure_monitor_close();
+
+}
+
+static inline int
+__sfa_shared_memory_anonymous()
+{
+
+    // Called through syscall, older C libraries lack the wrapper. The descriptor is
+    // deliberately inheritable so that exec'd stages can open it.
+#if defined (SYS_memfd_create)
+    return (int)syscall(SYS_memfd_create, "sfa_shared_heap", 0);
+#else
+    return -1;
+#endif
+
+}
+
+static inline void*
+__sfa_mesh_arena_map(uint64_t size, int *file)
+{
+
+    // The memfd is sparse, its pages only take up memory once written. A forked
+    // child would share the arena with its parent, so it doesn't inherit it at all.
+    *file = __sfa_shared_memory_anonymous();
+    if (*file < 0) return NULL;
+    fcntl(*file, F_SETFD, FD_CLOEXEC);
+
+    if (ftruncate(*file, (off_t)size) == 0)
+    {
+
+        void* buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, *file, 0);
+        if (buffer != MAP_FAILED && madvise(buffer, size, MADV_DONTFORK) == 0) return buffer;
+        if (buffer != MAP_FAILED) munmap(buffer, size);
+
+    }
+
+    close(*file);
+    *file = -1;
+    return NULL;
+
+}
+
+static inline bool
+__sfa_mesh_page_map(void *page, int file, uint64_t file_offset, uint64_t size)
+{
+
+    // The replacement mapping doesn't carry over the fork advice.
+    void* buffer = mmap(page, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, (off_t)file_offset);
+    if (buffer == MAP_FAILED) return false;
+    madvise(buffer, size, MADV_DONTFORK);
+    return true;
+
+}
+
+static inline void
+__sfa_mesh_page_release(int file, uint64_t file_offset, uint64_t size)
+{
+
+    syscall(SYS_fallocate, file, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)file_offset, (off_t)size);
+
+}
+
+static inline bool
+__sfa_mesh_page_protect(void *page, uint64_t size, bool is_writable)
+{
+
+    int protection = (is_writable) ? PROT_READ | PROT_WRITE : PROT_READ;
+    return (mprotect(page, size, protection) == 0);
+
+}
+
+static struct sigaction sfa_mesh_previous_fault;
+static bool sfa_mesh_fault_registered = false;
+
+static void
+__sfa_mesh_fault(int signal_number, siginfo_t *info, void *context)
+{
+
+    // A store into a span that is being meshed waits for the span to be remapped,
+    // returning then retries it on the merged page.
+    sfa_mesh_arena *arena = &sfa_global_mesh_arena;
+    uint8_t *address = (uint8_t*)info->si_addr;
+    if (info->si_code == SEGV_ACCERR && arena->base != NULL && address >= arena->base
+        && address < arena->base + arena->page_count * arena->page_size)
+    {
+        while (__atomic_load_n(&arena->is_meshing, __ATOMIC_ACQUIRE) != 0) sched_yield();
+        return;
+    }
+
+    // Any other fault belongs to the handler that was replaced. The default action
+    // is put back, and happens once the faulting instruction runs again.
+    struct sigaction *previous = &sfa_mesh_previous_fault;
+    if (previous->sa_flags & SA_SIGINFO)
+        previous->sa_sigaction(signal_number, info, context);
+    else if (previous->sa_handler == SIG_DFL || previous->sa_handler == SIG_IGN)
+        sigaction(signal_number, previous, NULL);
+    else
+        previous->sa_handler(signal_number);
+
+}
+
+static inline bool
+__sfa_mesh_fault_register()
+{
+
+    // Installed once, a forked child keeps the handler of its parent.
+    if (sfa_mesh_fault_registered) return true;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = __sfa_mesh_fault;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &sfa_mesh_previous_fault) != 0) return false;
+    sfa_mesh_fault_registered = true;
+    return true;
+
+}
+
+static inline void
+__sfa_pressure_monitor_close()
+{
+
+    int *wake_fds = sfa_pressure_monitor_wake_fds;
+    close(sfa_pressure_monitor_fd);
+    if (wake_fds[0] >= 0) close(wake_fds[0]);
+    if (wake_fds[1] >= 0) close(wake_fds[1]);
+    sfa_pressure_monitor_fd = -1;
+    wake_fds[0] = -1;
+    wake_fds[1] = -1;
+
+}
+
+#else
+
+static inline uint64_t
+__sfa_memory_limit()
+{
+
+    return 0;
+
+}
+
+static inline bool
+__sfa_pressure_monitor_start(uint64_t stall_microseconds, uint64_t window_microseconds)
+{
+
+    (void)stall_microseconds;
+    (void)window_microseconds;
+    return false;
+
+}
+
+static inline void
+__sfa_pressure_monitor_stop()
+{
+
+}
+
+static inline int
+__sfa_shared_memory_anonymous()
+{
+
+    return -1;
+
+}
+
+static inline void*
+__sfa_mesh_arena_map(uint64_t size, int *file)
+{
+
+    (void)size;
+    *file = -1;
+    return NULL;
+
+}
+
+static inline bool
+__sfa_mesh_page_map(void *page, int file, uint64_t file_offset, uint64_t size)
+{
+
+    (void)page;
+    (void)file;
+    (void)file_offset;
+    (void)size;
+    return false;
+
+}
+
+static inline void
+__sfa_mesh_page_release(int file, uint64_t file_offset, uint64_t size)
+{
+
+    (void)file;
+    (void)file_offset;
+    (void)size;
+
+}
+
+static inline bool
+__sfa_mesh_page_protect(void *page, uint64_t size, bool is_writable)
+{
+
+    (void)page;
+    (void)size;
+    (void)is_writable;
+    return false;
+
+}
+
+static inline bool
+__sfa_mesh_fault_register()
+{
+
+    return false;
+
+}
+
+#endif
+
+#endif
+
+
+// --- External API ------------------------------------------------------------
+//
+// Implementations of the external API functions.
+//
+
+bool
+sf_init(uint64_t reserve_size)
+{
+
+    return sf_init_ext(reserve_size, 0);
+
+}
+
+bool
+sf_init_ext(uint64_t reserve_size, uint64_t flags)
+{
+
+    sfa_state *state = __sfa_get_state();
+    sfa_pool_descriptor *prefault_pool = NULL;
+    bool is_initialized = true;
+    __sfa_lock_acquire(&state->lock);
+
+    if (state->head_pool == NULL)
+    {
+
+        if (flags & SFA_HEAP_HUGETLB) flags |= SFA_HEAP_HUGE_PAGES;
+        state->flags = flags;
+
+        // A failed pool leaves the heap uninitialized, as if this was never called.
+        sfa_pool_descriptor *pool = __sfa_create_pool(state, reserve_size);
+        is_initialized = (pool != NULL);
+        if (pool == NULL) state->flags = 0;
+        else __sfa_initialize_heap(state, pool);
+
+        // The pages are about to be resident, so the block no longer counts as purged.
+        if (pool != NULL && (flags & SFA_HEAP_PREFAULT))
+        {
+            pool->free_list->flags.is_purged = false;
+            prefault_pool = pool;
+        }
+
+    }
+
+    // Prefaulting starts threads, which may allocate, so it waits for the lock. The
+    // reservation alone may already cross the soft limit.
+    __sfa_release_state(state);
+    if (prefault_pool != NULL) __sfa_prefault_pool(prefault_pool);
+    return is_initialized;
+
+}
+
+bool
+sf_init_with_buffer(void *memory, uint64_t size)
+{
+
+    SFA_ASSERT_POINTER(memory);
+
+    // The pool descriptor is aligned within the buffer, and only whole allocation
+    // alignments are used past it.
+    uint64_t memory_begin = ((uint64_t)memory + SFA_ALLOCATION_ALIGNMENT_SIZE - 1) &
+        ~(uint64_t)(SFA_ALLOCATION_ALIGNMENT_SIZE - 1);
+    uint64_t memory_end = ((uint64_t)memory + size) & ~(uint64_t)(SFA_ALLOCATION_ALIGNMENT_SIZE - 1);
+    uint64_t minimum_size = __sfa_pool_descriptor_size() + __sfa_allocation_descriptor_size() +
+        SFA_ALLOCATION_MINIMUM_SIZE;
+    if (memory_end < memory_begin || memory_end - memory_begin < minimum_size) return false;
+
+    sfa_state *state = __sfa_get_state();
+    __sfa_lock_acquire(&state->lock);
+
+    bool is_initialized = false;
+    if (state->head_pool == NULL)
+    {
+
+        // Nothing is known about the contents, and the memory is never purged since it
+        // may be shared or file backed. It doesn't count as committed either.
+        sfa_pool_descriptor *pool = __sfa_format_pool(state, (void*)memory_begin, memory_end - memory_begin);
+        pool->pool_is_external = true;
+        pool->free_list->flags.is_purged = false;
+        pool->free_list->flags.is_zeroed = false;
+
+        __sfa_initialize_heap(state, pool);
+        is_initialized = true;
+
+    }
+
+    __sfa_release_state(state);
+    return is_initialized;
+
+}
+
+void*
+sf_alloc(uint64_t size)
+{
+
+    return sf_heap_alloc(NULL, size);
+
+}
+
+void*
+sf_alloc_aligned(uint64_t size, uint64_t alignment)
+{
+
+    return sf_heap_alloc_aligned(NULL, size, alignment);
+
+}
+
+void*
+sf_alloc_at_least(uint64_t size, uint64_t *actual_size)
+{
+
+    // Rounding and unsplit remainders mean that the block is often larger than the
+    // request, the caller is told exactly how much of it they may use.
+    void *user_ptr = sf_alloc(size);
+    if (actual_size != NULL) *actual_size = (user_ptr != NULL) ? sf_usable_size(user_ptr) : 0;
+    return user_ptr;
+
+}
+
+void*
+sf_alloc_near(void *hint, uint64_t size)
+{
+
+    // NOTE(Chris): The hint must be a live allocation. The new allocation comes from
+    //              the hint's heap, preferring the hint's own pool and then the free
+    //              block closest to it. The thread cache is bypassed since its blocks
+    //              could be anywhere.
+
+    if (hint == NULL) return sf_alloc(size);
+    if (size > SFA_ALLOCATION_MAXIMUM_SIZE) return NULL;
+
+    uint64_t required_size = __sfa_request_size_to_minimum_alloc_size(size);
+    uint64_t nearest_boundary = __sfa_request_size_to_nearest_boundary(required_size);
+
+    sfa_allocation_descriptor *hint_node = __sfa_get_descriptor(hint);
+    SFA_ASSERT(hint_node->flags.is_occupied);
+    sfa_pool_descriptor *pool = hint_node->parent_pool;
+    sfa_state *state = pool->parent_state;
+
+    __sfa_lock_acquire(&state->lock);
+
+    void *user_ptr = NULL;
+    sfa_pool_search search_results = { NULL, NULL };
+    if (__sfa_find_block_near(pool, nearest_boundary, (uint64_t)hint, &search_results))
+        user_ptr = __sfa_accomodate_allocation_near(nearest_boundary, (uint64_t)hint, &search_results);
+    else
+        user_ptr = __sfa_alloc_block(state, nearest_boundary);
+
+    __sfa_release_state(state);
+    return user_ptr;
+
+}
+
+void*
+sf_alloc_group(const uint64_t *sizes, const uint64_t *alignments, uint32_t count, void **out_ptrs)
+{
+
+    SFA_ASSERT_POINTER(sizes);
+    SFA_ASSERT_POINTER(out_ptrs);
+    if (count == 0) return NULL;
+
+    // First pass computes the size of the group and the strictest alignment, the
+    // group itself is aligned to it so every offset lands on its alignment.
+    uint64_t group_size = 0;
+    uint64_t group_alignment = SFA_ALLOCATION_ALIGNMENT_SIZE;
+    bool is_valid = true;
+    for (uint32_t index = 0; index < count && is_valid; ++index)
+    {
+
+        uint64_t alignment = (alignments != NULL) ? alignments[index] : SFA_ALLOCATION_ALIGNMENT_SIZE;
+        SFA_ASSERT(alignment != 0 && (alignment & (alignment - 1)) == 0);
+        if (alignment > group_alignment) group_alignment = alignment;
+
+        group_size = (group_size + alignment - 1) & ~(alignment - 1);
+        group_size += sizes[index];
+        is_valid = (sizes[index] <= SFA_ALLOCATION_MAXIMUM_SIZE && group_size <= SFA_ALLOCATION_MAXIMUM_SIZE);
+
+    }
+
+    uint8_t *group = (is_valid) ? (uint8_t*)sf_alloc_aligned(group_size, group_alignment) : NULL;
+
+    // Second pass hands out the parts, every part is NULL when the group failed.
+    uint64_t offset = 0;
+    for (uint32_t index = 0; index < count; ++index)
+    {
+
+        uint64_t alignment = (alignments != NULL) ? alignments[index] : SFA_ALLOCATION_ALIGNMENT_SIZE;
+        offset = (offset + alignment - 1) & ~(alignment - 1);
+        out_ptrs[index] = (group != NULL) ? group + offset : NULL;
+        offset += sizes[index];
+
+    }
+
+    SFA_ASSERT(group == NULL || out_ptrs[0] == group);
+    return group;
+
+}
+
+void
+sf_free_group(void *group)
+{
+
+    sf_free(group);
+
+}
+
+uint64_t
+sf_usable_size(void *ptr)
+{
+
+    if (ptr == NULL) return 0;
+
+    sfa_allocation_descriptor *node = __sfa_get_descriptor(ptr);
+    SFA_ASSERT(node->flags.is_occupied);
+    return node->allocation_size;
+
+}
+
+bool
+sf_try_expand(void *ptr, uint64_t new_size)
+{
+
+    if (ptr == NULL || new_size > SFA_ALLOCATION_MAXIMUM_SIZE) return false;
+
+    uint64_t required_size = __sfa_request_size_to_minimum_alloc_size(new_size);
+    uint64_t nearest_boundary = __sfa_request_size_to_nearest_boundary(required_size);
+
+    sfa_allocation_descriptor *node = __sfa_get_descriptor(ptr);
+    sfa_state *state = node->parent_pool->parent_state;
+    __sfa_lock_acquire(&state->lock);
+    bool expanded = __sfa_expand_block(node, nearest_boundary);
+    __sfa_lock_release(&state->lock);
+    return expanded;
+
+}
+
+bool
+sf_shrink(void *ptr, uint64_t new_size)
+{
+
+    // Sizes at or beyond the current size are no-ops, and are rejected before rounding
+    // so that huge sizes can't wrap around to a tiny boundary.
+    if (ptr == NULL || new_size > SFA_ALLOCATION_MAXIMUM_SIZE) return false;
+
+    sfa_allocation_descriptor *node = __sfa_get_descriptor(ptr);
+    if (new_size >= node->allocation_size) return false;
+
+    uint64_t required_size = __sfa_request_size_to_minimum_alloc_size(new_size);
+    uint64_t nearest_boundary = __sfa_request_size_to_nearest_boundary(required_size);
+
+    sfa_state *state = node->parent_pool->parent_state;
+    __sfa_lock_acquire(&state->lock);
+    bool shrunk = __sfa_shrink_block(node, nearest_boundary);
+    __sfa_lock_release(&state->lock);
+    return shrunk;
+
+}
+
+void
+sf_free(void *ptr)
+{
+
+    if (ptr == NULL) return;
+
+    sfa_allocation_descriptor *node = __sfa_get_descriptor(ptr);
+    SFA_ASSERT(node->flags.is_occupied);
+    SFA_ASSERT(node->block_pointer == ptr);
+
+    // Movable blocks belong to their handle, freeing one here would leave the handle
+    // pointing at a free block. They're left alone, see sf_handle_free.
+    SFA_ASSERT(node->flags.is_movable == false);
+    if (node->flags.is_movable) return;
+
+    // The owning heap is found through the pool, which never changes while the
+    // block is occupied. Small blocks of the default heap go to the thread cache.
+    sfa_state *state = node->parent_pool->parent_state;
+    if (state == __sfa_get_state() && node->allocation_size <= SFA_THREAD_CACHE_MAXIMUM_SIZE &&
+        __sfa_thread_cache_push(ptr, __sfa_thread_cache_class(node->allocation_size)))
+        return;
+
+    __sfa_lock_acquire(&state->lock);
+    __sfa_free_block(state, node);
+    __sfa_lock_release(&state->lock);
+
+}
+
+void
+sf_free_sized(void *ptr, uint64_t size)
+{
+
+    // NOTE(Chris): The size must be the size originally requested. Since that
+    //              determines the size class, small blocks of the default heap go
+    //              into the thread cache without reading their size. Blocks of any
+    //              other heap, and handle blocks, must never reach the cache, they
+    //              go through sf_free instead.
+
+    if (ptr == NULL) return;
+
+    sfa_allocation_descriptor *node = __sfa_get_descriptor(ptr);
+    if (node->parent_pool->parent_state != __sfa_get_state() || node->flags.is_movable)
+    {
+        sf_free(ptr);
+        return;
+    }
+
+    uint64_t required_size = __sfa_request_size_to_minimum_alloc_size(size);
+    uint64_t nearest_boundary = __sfa_request_size_to_nearest_boundary(required_size);
+    SFA_ASSERT(node->allocation_size >= nearest_boundary);
+    if (nearest_boundary <= SFA_THREAD_CACHE_MAXIMUM_SIZE &&
+        __sfa_thread_cache_push(ptr, __sfa_thread_cache_class(nearest_boundary)))
+        return;
+
+    sf_free(ptr);
+
+}
+
+void*
+sf_alloc_class(uint64_t class_index)
+{
+
+    void *user_ptr = __sfa_thread_cache_pop(class_index);
+    if (user_ptr != NULL) return user_ptr;
+    return __sfa_thread_cache_refill(class_index);
+
+}
+
+void
+sf_free_class(void *ptr, uint64_t class_index)
+{
+
+    if (ptr == NULL) return;
+    SFA_ASSERT(__sfa_get_descriptor(ptr)->allocation_size >= SFA_SIZE_CLASS_SIZE(class_index));
+    if (__sfa_thread_cache_push(ptr, class_index)) return;
+
+    sf_free(ptr);
+
+}
+
+void*
+sf_mesh_alloc(uint64_t class_index)
+{
+
+    SFA_ASSERT(class_index < SFA_THREAD_CACHE_CLASS_COUNT);
+    sfa_mesh_arena *arena = &sfa_global_mesh_arena;
+    __sfa_lock_acquire(&arena->lock);
+
+    if (arena->initialized == false) __sfa_mesh_initialize(arena);
+    uint32_t span_link = (arena->base != NULL) ? arena->partial_spans[class_index] : 0;
+    if (span_link == 0 && arena->base != NULL) span_link = __sfa_mesh_create_span(arena, class_index);
+
+    void *user_ptr = NULL;
+    if (span_link != 0)
+    {
+
+        // Partial spans always have a free block, spans leave the list once full.
+        sfa_mesh_span *span = &arena->spans[span_link - 1];
+        uint64_t object_count = __sfa_mesh_object_count(arena, class_index);
+        uint64_t object_index = 0;
+        while (span->occupied[object_index / 64] & ((uint64_t)1 << (object_index % 64)))
+            object_index += 1;
+
+        SFA_ASSERT(object_index < object_count);
+        span->occupied[object_index / 64] |= ((uint64_t)1 << (object_index % 64));
+        span->occupied_count += 1;
+        arena->block_count += 1;
+        if (span->occupied_count == object_count) __sfa_mesh_partial_remove(arena, span_link - 1);
+        user_ptr = arena->base + (uint64_t)(span_link - 1) * arena->page_size +
+            object_index * SFA_SIZE_CLASS_SIZE(class_index);
+
+    }
+
+    __sfa_lock_release(&arena->lock);
+    return user_ptr;
+
+}
+
+void
+sf_mesh_free(void *ptr)
+{
+
+    if (ptr == NULL) return;
+
+    sfa_mesh_arena *arena = &sfa_global_mesh_arena;
+    __sfa_lock_acquire(&arena->lock);
+
+    // The block's span is found through whichever virtual page it was freed with.
+    uint64_t offset = (uint64_t)((uint8_t*)ptr - arena->base);
+    SFA_ASSERT(arena->base != NULL && offset < arena->page_count * arena->page_size);
+    uint32_t span_index = arena->page_spans[offset / arena->page_size] - 1;
+    sfa_mesh_span *span = &arena->spans[span_index];
+    uint64_t object_index = (offset % arena->page_size) / SFA_SIZE_CLASS_SIZE(span->class_index);
+    uint64_t object_bit = (uint64_t)1 << (object_index % 64);
+    SFA_ASSERT(span->occupied[object_index / 64] & object_bit);
+
+    span->occupied[object_index / 64] &= ~object_bit;
+    if (span->occupied_count == __sfa_mesh_object_count(arena, span->class_index))
+        __sfa_mesh_partial_insert(arena, span_index);
+    span->occupied_count -= 1;
+    arena->block_count -= 1;
+
+    // Empty spans are released, except for the last partial span of an unmeshed
+    // class so that a single block churning doesn't fault in a page every time.
+    bool is_last_span = (span->prev_span == 0 && span->next_span == 0);
+    if (span->occupied_count == 0 && (span->page_count > 1 || !is_last_span))
+        __sfa_mesh_release_span(arena, span_index);
+
+    __sfa_lock_release(&arena->lock);
+
+}
+
+uint64_t
+sf_mesh(void)
+{
+
+    sfa_mesh_arena *arena = &sfa_global_mesh_arena;
+    __sfa_lock_acquire(&arena->lock);
+
+    // Each partial span absorbs whichever of the spans behind it it can, those are
+    // taken off the list as they are meshed.
+    uint64_t meshed_size = 0;
+    for (uint64_t class_index = 0; arena->base != NULL && class_index < SFA_THREAD_CACHE_CLASS_COUNT; ++class_index)
+    {
+
+        uint64_t object_count = __sfa_mesh_object_count(arena, class_index);
+        uint32_t span_link = arena->partial_spans[class_index];
+        while (span_link != 0)
+        {
+
+            sfa_mesh_span *span = &arena->spans[span_link - 1];
+            uint32_t other_link = span->next_span;
+            for (uint32_t probe = 0; other_link != 0 && probe < SFA_MESH_PROBES; ++probe)
+            {
+                uint32_t next_link = arena->spans[other_link - 1].next_span;
+                if (__sfa_mesh_spans(arena, span_link - 1, other_link - 1)) meshed_size += arena->page_size;
+                other_link = next_link;
+            }
+
+            uint32_t next_link = span->next_span;
+            if (span->occupied_count == object_count) __sfa_mesh_partial_remove(arena, span_link - 1);
+            span_link = next_link;
+
+        }
+
+    }
+
+    __sfa_lock_release(&arena->lock);
+    return meshed_size;
+
+}
+
+sfa_handle
+sf_handle_alloc(sfa_heap *heap, uint64_t size)
+{
+
+    // Movable blocks never go through the thread cache.
+    sfa_state *state = __sfa_get_heap_state(heap);
+    if (size > SFA_ALLOCATION_MAXIMUM_SIZE) return 0;
+
+    uint64_t required_size = __sfa_request_size_to_minimum_alloc_size(size);
+    uint64_t nearest_boundary = __sfa_request_size_to_nearest_boundary(required_size);
+
+    sfa_handle handle = 0;
+    sfa_handle_table *table = &sfa_global_handle_table;
+    __sfa_lock_acquire(&state->lock);
+    void *user_ptr = __sfa_alloc_block(state, nearest_boundary);
+    if (user_ptr != NULL)
+    {
+
+        __sfa_lock_acquire(&table->lock);
+        handle = __sfa_handle_create(table, state, user_ptr);
+        __sfa_lock_release(&table->lock);
+        if (handle == 0) __sfa_free_block(state, __sfa_get_descriptor(user_ptr));
+
+    }
+
+    __sfa_release_state(state);
+    return handle;
+
+}
+
+void
+sf_handle_free(sfa_handle handle)
+{
+
+    if (handle == 0) return;
+
+    // The heap lock comes first, the block can't move while it's held.
+    sfa_handle_table *table = &sfa_global_handle_table;
+    __sfa_lock_acquire(&table->lock);
+    sfa_state *state = __sfa_handle_entry(table, handle)->parent_state;
+    __sfa_lock_release(&table->lock);
+
+    __sfa_lock_acquire(&state->lock);
+    __sfa_lock_acquire(&table->lock);
+    sfa_handle_entry *entry = __sfa_handle_entry(table, handle);
+    SFA_ASSERT(entry->lock_count == 0);
+    sfa_allocation_descriptor *node = __sfa_get_descriptor(entry->block_pointer);
+    __sfa_handle_release(table, entry);
+    __sfa_lock_release(&table->lock);
+
+    node->flags.is_movable = false;
+    node->flags.handle_index = 0;
+    __sfa_free_block(state, node);
+    __sfa_lock_release(&state->lock);
+
+}
+
+void*
+sf_handle_lock(sfa_handle handle)
+{
+
+    sfa_handle_table *table = &sfa_global_handle_table;
+    __sfa_lock_acquire(&table->lock);
+    sfa_handle_entry *entry = __sfa_handle_entry(table, handle);
+    entry->lock_count += 1;
+    void *user_ptr = entry->block_pointer;
+    __sfa_lock_release(&table->lock);
+    return user_ptr;
+
+}
+
+void
+sf_handle_unlock(sfa_handle handle)
+{
+
+    sfa_handle_table *table = &sfa_global_handle_table;
+    __sfa_lock_acquire(&table->lock);
+    sfa_handle_entry *entry = __sfa_handle_entry(table, handle);
+    SFA_ASSERT(entry->lock_count > 0);
+    entry->lock_count -= 1;
+    __sfa_lock_release(&table->lock);
+
+}
+
+uint64_t
+sf_heap_compact(sfa_heap *heap, uint64_t budget_microseconds)
+{
+
+    sfa_state *state = __sfa_get_heap_state(heap);
+    uint64_t deadline = __sfa_time_microseconds() + budget_microseconds;
+    uint64_t moved_size = 0;
+    __sfa_lock_acquire(&state->lock);
+
+    // Large pools hold a single block, there is nothing to slide within them. Once
+    // the last pool is done, the next step starts over with the head pool.
+    sfa_pool_descriptor *pool = (state->compact_pool != NULL) ? state->compact_pool : state->head_pool;
+    for (; pool != NULL; pool = pool->next_pool)
+    {
+        if (__sfa_compact_pool(state, pool, deadline, &moved_size) == false) break;
+    }
+
+    __sfa_lock_release(&state->lock);
+    return moved_size;
+
+}
+
+sfa_heap*
+sf_heap_create(uint64_t reserve_size)
+{
+
+    return sf_heap_create_ext(reserve_size, 0);
+
+}
+
+sfa_heap*
+sf_heap_create_ext(uint64_t reserve_size, uint64_t flags)
+{
+
+    // The heap's state is an allocation of the default heap, so that its flags are
+    // known before its initial pool is created.
+    sfa_state *state = (sfa_state*)sf_alloc(sizeof(sfa_state));
+    if (state == NULL) return NULL;
+
+    memset(state, 0, sizeof(sfa_state));
+    __sfa_lock_init(&state->lock);
+    if (flags & SFA_HEAP_HUGETLB) flags |= SFA_HEAP_HUGE_PAGES;
+    state->flags = flags;
+
+    sfa_pool_descriptor *pool = __sfa_create_pool(state, reserve_size);
+    if (pool == NULL)
+    {
+        __sfa_lock_destroy(&state->lock);
+        sf_free(state);
+        return NULL;
+    }
+
+    if (flags & SFA_HEAP_PREFAULT)
+    {
+        pool->free_list->flags.is_purged = false;
+        __sfa_prefault_pool(pool);
+    }
+
+    __sfa_initialize_heap(state, pool);
+    __sfa_registry_insert(state);
+    return state;
+
+}
+
+void
+sf_heap_destroy(sfa_heap *heap)
+{
+
+    // Releases every pool of the heap at once, outstanding allocations included.
+    SFA_ASSERT_POINTER(heap);
+    SFA_ASSERT(heap != __sfa_get_state());
+    __sfa_registry_remove(heap);
+
+    // Handles into the heap are released as well, the stale ones then fail their
+    // generation check instead of reaching into unmapped pools.
+    sfa_handle_table *table = &sfa_global_handle_table;
+    __sfa_lock_acquire(&table->lock);
+    for (uint64_t entry_index = 0; entry_index < table->entry_count; ++entry_index)
+    {
+
+        sfa_handle_entry *entry = &table->entries[entry_index];
+        if (entry->parent_state != heap) continue;
+        SFA_ASSERT(entry->lock_count == 0);
+        __sfa_handle_release(table, entry);
+
+    }
+
+    __sfa_lock_release(&table->lock);
+    heap->compact_pool = NULL;
+    heap->compact_node = NULL;
+
+    sfa_pool_descriptor *pools[3] = { heap->large_pools, heap->head_pool, heap->retained_pools };
+    for (uint32_t list_index = 0; list_index < 3; ++list_index)
+    {
+
+        sfa_pool_descriptor *current_pool = pools[list_index];
+        while (current_pool != NULL)
+        {
+
+            sfa_pool_descriptor *next_pool = current_pool->next_pool;
+            __sfa_unmap_pool(current_pool);
+            current_pool = next_pool;
+
+        }
+
+    }
+
+    __sfa_lock_destroy(&heap->lock);
+    sf_free(heap);
+
+}
+
+void*
+sf_heap_alloc(sfa_heap *heap, uint64_t size)
+{
+
+    sfa_state *state = __sfa_get_heap_state(heap);
+    if (size > SFA_ALLOCATION_MAXIMUM_SIZE) return NULL;
+
+    // Size to the minimum size if required.
+    uint64_t required_size = __sfa_request_size_to_minimum_alloc_size(size);
+    uint64_t nearest_boundary = __sfa_request_size_to_nearest_boundary(required_size);
+
+    // Small default heap allocations are served from the thread cache.
+    if (state == __sfa_get_state() && nearest_boundary <= SFA_THREAD_CACHE_MAXIMUM_SIZE)
+        return sf_alloc_class(__sfa_thread_cache_class(nearest_boundary));
+
+    __sfa_lock_acquire(&state->lock);
+    void *user_ptr = __sfa_alloc_block(state, nearest_boundary);
+    __sfa_release_state(state);
+    return user_ptr;
+
+}
+
+void*
+sf_heap_alloc_aligned(sfa_heap *heap, uint64_t size, uint64_t alignment)
+{
+
+    // Alignments must be a power of two, anything at or below the natural alignment
+    // is just a regular allocation.
+    SFA_ASSERT(alignment != 0 && (alignment & (alignment - 1)) == 0);
+    if (alignment <= SFA_ALLOCATION_ALIGNMENT_SIZE) return sf_heap_alloc(heap, size);
+
+    sfa_state *state = __sfa_get_heap_state(heap);
+    if (size > SFA_ALLOCATION_MAXIMUM_SIZE || alignment > SFA_ALLOCATION_MAXIMUM_SIZE) return NULL;
+
+    uint64_t required_size = __sfa_request_size_to_minimum_alloc_size(size);
+    uint64_t nearest_boundary = __sfa_request_size_to_nearest_boundary(required_size);
+    uint64_t search_size = nearest_boundary + alignment +
+        __sfa_allocation_descriptor_size() + SFA_ALLOCATION_MINIMUM_SIZE;
+
+    __sfa_lock_acquire(&state->lock);
+
+    void *user_ptr = NULL;
+    sfa_pool_search search_results = { NULL, NULL };
+    if (__sfa_find_pool_for_alloc(state, search_size, &search_results))
+    {
+
+        user_ptr = __sfa_accomodate_aligned_allocation(nearest_boundary, alignment, &search_results);
+        SFA_ASSERT(((uint64_t)user_ptr & (alignment - 1)) == 0);
+
+    }
+
+    __sfa_release_state(state);
+    return user_ptr;
+
+}
+
+void*
+sf_alloc_zeroed(uint64_t size)
+{
+
+    return sf_heap_alloc_zeroed(NULL, size);
+
+}
+
+void*
+sf_alloc_hint(uint64_t size, uint64_t lifetime)
+{
+
+    SFA_ASSERT(lifetime <= SFA_LIFETIME_PERMANENT);
+    if (lifetime == SFA_LIFETIME_SHORT) return sf_alloc(size);
+    if (size > SFA_ALLOCATION_MAXIMUM_SIZE) return NULL;
+
+    sfa_state *state = __sfa_lifetime_heap(&sfa_global_lifetime_heaps, lifetime);
+    if (state == NULL) return NULL;
+    return sf_heap_alloc(state, size);
+
+}
+
+void*
+sf_alloc_permanent(uint64_t size)
+{
+
+    if (size > SFA_ALLOCATION_MAXIMUM_SIZE) return NULL;
+
+    sfa_lifetime_heaps *lifetimes = &sfa_global_lifetime_heaps;
+    sfa_state *state = __sfa_lifetime_heap(lifetimes, SFA_LIFETIME_PERMANENT);
+    if (state == NULL) return NULL;
+
+    __sfa_lock_acquire(&state->lock);
+    void *user_ptr = __sfa_permanent_alloc(lifetimes, state, size);
+    __sfa_release_state(state);
+    return user_ptr;
+
+}
+
+void*
+sf_heap_alloc_zeroed(sfa_heap *heap, uint64_t size)
+{
+
+    sfa_state *state = __sfa_get_heap_state(heap);
+    if (size > SFA_ALLOCATION_MAXIMUM_SIZE) return NULL;
+
+    uint64_t required_size = __sfa_request_size_to_minimum_alloc_size(size);
+    uint64_t nearest_boundary = __sfa_request_size_to_nearest_boundary(required_size);
+
+    // Thread cached blocks are small enough that clearing them beats tracking them.
+    if (state == __sfa_get_state() && nearest_boundary <= SFA_THREAD_CACHE_MAXIMUM_SIZE)
+    {
+        void *user_ptr = sf_alloc_class(__sfa_thread_cache_class(nearest_boundary));
+        if (user_ptr != NULL) memset(user_ptr, 0, size);
+        return user_ptr;
+    }
+
+    // Otherwise, the pages which are known to read as zero are left untouched so that
+    // large allocations aren't faulted in just to be cleared.
+    uint64_t zeroed_begin = 0;
+    uint64_t zeroed_end = 0;
+    void *user_ptr = NULL;
+
+    __sfa_lock_acquire(&state->lock);
+
+    sfa_pool_search search_results = { NULL, NULL };
+    if (__sfa_find_pool_for_alloc(state, nearest_boundary, &search_results))
+    {
+
+        sfa_allocation_descriptor *node = *search_results.list_node;
+        if (node->flags.is_zeroed) __sfa_purgeable_range(state, node, &zeroed_begin, &zeroed_end);
+        user_ptr = __sfa_accomodate_allocation(nearest_boundary, &search_results);
+
+    }
+
+    __sfa_release_state(state);
+    if (user_ptr == NULL) return NULL;
+
+    uint64_t clear_begin = (uint64_t)user_ptr;
+    uint64_t clear_end = clear_begin + size;
+    if (zeroed_begin < clear_begin) zeroed_begin = clear_begin;
+    if (zeroed_end > clear_end) zeroed_end = clear_end;
+
+    if (zeroed_begin >= zeroed_end)
+    {
+        memset(user_ptr, 0, size);
+    }
+
+    else
+    {
+        memset((void*)clear_begin, 0, zeroed_begin - clear_begin);
+        memset((void*)zeroed_end, 0, clear_end - zeroed_end);
+    }
+
+    return user_ptr;
+
+}
+
+uint64_t
+sf_purge(void)
+{
+
+    return sf_heap_purge(NULL);
+
+}
+
+uint64_t
+sf_heap_purge(sfa_heap *heap)
+{
+
+    sfa_state *state = __sfa_get_heap_state(heap);
+    __sfa_lock_acquire(&state->lock);
+    uint64_t purged_size = __sfa_purge_heap(state);
+    __sfa_lock_release(&state->lock);
+    return purged_size;
+
+}
+
+bool
+sf_decay_start(uint64_t decay_milliseconds)
+{
+
+    // The default heap must exist before the thread starts sweeping it.
+    if (decay_milliseconds == 0) return false;
+    __sfa_get_heap_state(NULL);
+
+    sfa_registry *registry = &sfa_global_registry;
+    __sfa_lock_acquire(&registry->lock);
+
+    registry->decay_time = decay_milliseconds;
+    for (sfa_state *state = __sfa_get_state(); state != NULL; state = state->next_heap)
+    {
+        __sfa_lock_acquire(&state->lock);
+        state->decay_time = decay_milliseconds;
+        __sfa_lock_release(&state->lock);
+    }
+
+    bool started = true;
+    if (registry->decay_running == false)
+    {
+        registry->decay_running = __sfa_thread_create(&registry->decay_thread, __sfa_decay_thread);
+        started = registry->decay_running;
+    }
+
+    __sfa_lock_release(&registry->lock);
+    if (started == false) sf_decay_stop();
+    return started;
+
+}
+
+void
+sf_decay_stop(void)
+{
+
+    sfa_registry *registry = &sfa_global_registry;
+    __sfa_lock_acquire(&registry->lock);
+
+    bool was_running = registry->decay_running;
+    registry->decay_running = false;
+    registry->decay_time = 0;
+    for (sfa_state *state = __sfa_get_state(); state != NULL; state = state->next_heap)
+    {
+        __sfa_lock_acquire(&state->lock);
+        state->decay_time = 0;
+        __sfa_lock_release(&state->lock);
+    }
+
+    __sfa_condition_signal(&registry->condition);
+    __sfa_lock_release(&registry->lock);
+
+    if (was_running) __sfa_thread_join(registry->decay_thread);
+
+}
+
+void
+sf_heap_set_limits(sfa_heap *heap, uint64_t soft_limit, uint64_t hard_limit)
+{
+
+    SFA_ASSERT(hard_limit == 0 || soft_limit <= hard_limit);
+    sfa_state *state = __sfa_get_heap_state(heap);
+    __sfa_lock_acquire(&state->lock);
+
+    // A heap which is already past its new soft limit reacts right away.
+    state->soft_limit = soft_limit;
+    state->hard_limit = hard_limit;
+    if (soft_limit > 0 && state->committed_size >= soft_limit)
+    {
+        state->pressure_pending = true;
+        __sfa_purge_heap(state);
+    }
+
+    __sfa_release_state(state);
+
+}
+
+bool
+sf_heap_add_pressure_callback(sfa_heap *heap, sfa_pressure_callback callback, void *user_data)
+{
+
+    SFA_ASSERT_POINTER(callback);
+    sfa_state *state = __sfa_get_heap_state(heap);
+    __sfa_lock_acquire(&state->lock);
+
+    bool added = (state->pressure_handler_count < SFA_PRESSURE_CALLBACK_COUNT);
+    if (added)
+    {
+        sfa_pressure_handler *handler = &state->pressure_handlers[state->pressure_handler_count++];
+        handler->callback = callback;
+        handler->user_data = user_data;
+    }
+
+    __sfa_lock_release(&state->lock);
+    return added;
+
+}
+
+void
+sf_heap_remove_pressure_callback(sfa_heap *heap, sfa_pressure_callback callback, void *user_data)
+{
+
+    sfa_state *state = __sfa_get_heap_state(heap);
+    __sfa_lock_acquire(&state->lock);
+
+    for (uint32_t index = 0; index < state->pressure_handler_count; ++index)
+    {
+
+        sfa_pressure_handler *handler = &state->pressure_handlers[index];
+        if (handler->callback == callback && handler->user_data == user_data)
+        {
+            *handler = state->pressure_handlers[--state->pressure_handler_count];
+            break;
+        }
+
+    }
+
+    __sfa_lock_release(&state->lock);
+
+}
+
+bool
+sf_pressure_monitor_start(uint64_t stall_microseconds, uint64_t window_microseconds)
+{
+
+    sfa_registry *registry = &sfa_global_registry;
+    __sfa_lock_acquire(&registry->lock);
+
+    if (registry->pressure_monitor_running == false)
+        registry->pressure_monitor_running = __sfa_pressure_monitor_start(stall_microseconds, window_microseconds);
+    bool is_running = registry->pressure_monitor_running;
+
+    __sfa_lock_release(&registry->lock);
+    return is_running;
+
+}
+
+void
+sf_pressure_monitor_stop(void)
+{
 
-// --- External API ------------------------------------------------------------
+    sfa_registry *registry = &sfa_global_registry;
+    __sfa_lock_acquire(&registry->lock);
+    bool was_running = registry->pressure_monitor_running;
+    registry->pressure_monitor_running = false;
+    __sfa_lock_release(&registry->lock);
+    if (was_running) __sfa_pressure_monitor_stop();
+
+}
+
+uint64_t
+sf_heap_committed_size(sfa_heap *heap)
+{
+
+    sfa_state *state = __sfa_get_heap_state(heap);
+    __sfa_lock_acquire(&state->lock);
+    uint64_t committed_size = state->committed_size;
+    __sfa_lock_release(&state->lock);
+    return committed_size;
+
+}
+
+uint64_t
+sf_locked_size(void)
+{
+
+    sfa_memory_lock *memory_lock = &sfa_global_memory_lock;
+    __sfa_lock_acquire(&memory_lock->lock);
+    uint64_t locked_size = memory_lock->locked_size;
+    __sfa_lock_release(&memory_lock->lock);
+    return locked_size;
+
+}
+
+int32_t
+sf_lock_error(void)
+{
+
+    sfa_memory_lock *memory_lock = &sfa_global_memory_lock;
+    __sfa_lock_acquire(&memory_lock->lock);
+    int32_t lock_error = memory_lock->lock_error;
+    __sfa_lock_release(&memory_lock->lock);
+    return lock_error;
+
+}
+
+uint64_t
+sf_lock_limit(void)
+{
+
+    return __sfa_virtual_lock_limit();
+
+}
+
+bool
+sf_heap_walk(sfa_heap *heap, sfa_walk_callback visit, void *user_data)
+{
+
+    SFA_ASSERT_POINTER(visit);
+    sfa_state *state = __sfa_get_heap_state(heap);
+    __sfa_lock_acquire(&state->lock);
+    bool is_complete = __sfa_walk_heap(state, visit, user_data);
+    __sfa_lock_release(&state->lock);
+    return is_complete;
+
+}
+
+int64_t
+sf_heap_snapshot(sfa_heap *heap, sfa_walk_callback visit, void *user_data)
+{
+
+    // The child only exits, it never returns into the caller's code. The mesh arena
+    // isn't inherited, so a heap holding pointers into it can't be walked there.
+    SFA_ASSERT_POINTER(visit);
+    sfa_mesh_arena *arena = &sfa_global_mesh_arena;
+    __sfa_lock_acquire(&arena->lock);
+    uint64_t mesh_block_count = arena->block_count;
+    __sfa_lock_release(&arena->lock);
+    if (mesh_block_count != 0) return -1;
+
+    __sfa_fork_register();
+    int64_t process = __sfa_process_fork();
+    if (process != 0) return process;
+
+    __sfa_process_exit(sf_heap_walk(heap, visit, user_data));
+    return -1;
+
+}
+
+bool
+sf_snapshot_wait(int64_t snapshot)
+{
+
+    if (snapshot < 0) return false;
+    return __sfa_process_wait(snapshot);
+
+}
+
+// --- Growable Buffers --------------------------------------------------------
 //
-// Implementations of the external API functions.
+// Buffers always report the usable size of their block as their capacity, which
+// tends to be larger than requested due to rounding and unsplit remainders. When
+// growing, the block first attempts to expand into its right neighbor.
 //
 
+bool
+sf_buffer_try_grow(sfa_buffer *buffer, uint64_t capacity)
+{
+
+    SFA_ASSERT_POINTER(buffer);
+    if (capacity <= buffer->capacity) return true;
+    if (buffer->data == NULL) return false;
+
+    if (sf_try_expand(buffer->data, capacity) == false) return false;
+    buffer->capacity = sf_usable_size(buffer->data);
+    return true;
+
+}
+
+bool
+sf_buffer_reserve(sfa_buffer *buffer, uint64_t capacity)
+{
+
+    SFA_ASSERT_POINTER(buffer);
+    if (sf_buffer_try_grow(buffer, capacity)) return true;
+
+    void *data = sf_heap_alloc(buffer->heap, capacity);
+    if (data == NULL) return false;
+
+    if (buffer->data != NULL)
+    {
+        memcpy(data, buffer->data, buffer->size);
+        sf_free(buffer->data);
+    }
+
+    buffer->data = data;
+    buffer->capacity = sf_usable_size(data);
+    return true;
+
+}
+
+bool
+sf_buffer_append(sfa_buffer *buffer, const void *data, uint64_t size)
+{
+
+    SFA_ASSERT_POINTER(buffer);
+    uint64_t required_capacity = buffer->size + size;
+    if (required_capacity > buffer->capacity)
+    {
+
+        // Grow geometrically, but settle for exactly what's required in place before
+        // moving the whole buffer somewhere else.
+        uint64_t grown_capacity = buffer->capacity + (buffer->capacity / 2);
+        if (grown_capacity < required_capacity) grown_capacity = required_capacity;
+        if (sf_buffer_try_grow(buffer, grown_capacity) == false &&
+            sf_buffer_try_grow(buffer, required_capacity) == false &&
+            sf_buffer_reserve(buffer, grown_capacity) == false)
+            return false;
+
+    }
+
+    memcpy((uint8_t*)buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return true;
+
+}
+
 void
-sf_init(uint64_t reserve_size)
+sf_buffer_shrink_to_fit(sfa_buffer *buffer)
 {
 
-    sfa_state *state = __sfa_get_state();
-    sfa_pool_descriptor *pool = __sfa_create_pool(reserve_size);
-    SFA_ASSERT_POINTER(pool);
+    SFA_ASSERT_POINTER(buffer);
+    if (buffer->data == NULL) return;
+
+    if (buffer->size == 0)
+    {
+        sf_buffer_release(buffer);
+        return;
+    }
+
+    if (sf_shrink(buffer->data, buffer->size))
+        buffer->capacity = sf_usable_size(buffer->data);
 
-    state->head_pool = pool;
-    state->tail_pool = pool;
-    
 }
 
-void*   
-sf_alloc(uint64_t size)
+void
+sf_buffer_release(sfa_buffer *buffer)
 {
 
-    // Ensure that we have a valid pool initialized.
-    sfa_state *state = __sfa_get_state();
-    if (state->head_pool == NULL) sf_init(SFA_DEFAULT_INITIAL_POOL_SIZE);
+    SFA_ASSERT_POINTER(buffer);
+    sf_free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+
+}
+
+// --- Shared Heaps ------------------------------------------------------------
+//
+// Shared heaps are a compact boundary tag allocator of their own, since the pools
+// of regular heaps link everything by address. Blocks are found first-fit through a
+// single free list and coallesce with both neighbors when freed. The region never
+// grows, every process would need to remap it at once.
+//
+
+static inline uint64_t
+__sfa_shared_region_size()
+{
+
+    return __sfa_request_size_to_nearest_boundary(sizeof(sfa_shared_region));
+
+}
+
+static inline uint64_t
+__sfa_shared_block_size()
+{
+
+    return __sfa_request_size_to_nearest_boundary(sizeof(sfa_shared_block));
+
+}
+
+static inline sfa_shared_block*
+__sfa_shared_block_at(sfa_shared_region *region, uint64_t offset)
+{
+
+    if (offset == 0) return NULL;
+    return (sfa_shared_block*)((uint8_t*)region + offset);
+
+}
+
+static inline void
+__sfa_shared_free_list_insert(sfa_shared_region *region, sfa_shared_block *block, uint64_t offset)
+{
+
+    sfa_shared_block *head = __sfa_shared_block_at(region, region->free_list);
+    block->prev_free = 0;
+    block->next_free = region->free_list;
+    if (head != NULL) head->prev_free = offset;
+    region->free_list = offset;
+
+}
+
+static inline void
+__sfa_shared_free_list_remove(sfa_shared_region *region, sfa_shared_block *block)
+{
+
+    sfa_shared_block *prev = __sfa_shared_block_at(region, block->prev_free);
+    sfa_shared_block *next = __sfa_shared_block_at(region, block->next_free);
+    if (prev != NULL) prev->next_free = block->next_free;
+    else region->free_list = block->next_free;
+    if (next != NULL) next->prev_free = block->prev_free;
+
+    block->next_free = 0;
+    block->prev_free = 0;
+
+}
+
+static inline void*
+__sfa_shared_alloc_block(sfa_shared_region *region, uint64_t size)
+{
+
+    uint64_t block_offset = __sfa_shared_block_size();
+    uint64_t offset = region->free_list;
+    while (offset != 0)
+    {
+
+        sfa_shared_block *block = __sfa_shared_block_at(region, offset);
+        if (block->block_size < size)
+        {
+            offset = block->next_free;
+            continue;
+        }
+
+        // Split off the remainder whenever it can hold a block of its own.
+        __sfa_shared_free_list_remove(region, block);
+        if (block->block_size >= size + block_offset + SFA_ALLOCATION_MINIMUM_SIZE)
+        {
+
+            uint64_t split_offset = offset + block_offset + size;
+            sfa_shared_block *split = __sfa_shared_block_at(region, split_offset);
+            split->block_size   = block->block_size - size - block_offset;
+            split->is_occupied  = false;
+            split->left_block   = offset;
+            split->right_block  = block->right_block;
+
+            sfa_shared_block *right = __sfa_shared_block_at(region, block->right_block);
+            if (right != NULL) right->left_block = split_offset;
+            block->right_block = split_offset;
+            block->block_size = size;
+            __sfa_shared_free_list_insert(region, split, split_offset);
+
+        }
+
+        block->is_occupied = true;
+        return (uint8_t*)block + block_offset;
+
+    }
+
+    return NULL;
+
+}
+
+static inline void
+__sfa_shared_free_block(sfa_shared_region *region, sfa_shared_block *block)
+{
+
+    uint64_t block_offset = __sfa_shared_block_size();
+    uint64_t offset = (uint64_t)((uint8_t*)block - (uint8_t*)region);
+    block->is_occupied = false;
+
+    // Coallesce with the right neighbor, absorbing it into this block.
+    sfa_shared_block *right = __sfa_shared_block_at(region, block->right_block);
+    if (right != NULL && right->is_occupied == false)
+    {
+
+        __sfa_shared_free_list_remove(region, right);
+        block->block_size += block_offset + right->block_size;
+        block->right_block = right->right_block;
+        sfa_shared_block *next = __sfa_shared_block_at(region, right->right_block);
+        if (next != NULL) next->left_block = offset;
+
+    }
+
+    // Coallesce with the left neighbor, this block is absorbed into it.
+    sfa_shared_block *left = __sfa_shared_block_at(region, block->left_block);
+    if (left != NULL && left->is_occupied == false)
+    {
+
+        __sfa_shared_free_list_remove(region, left);
+        left->block_size += block_offset + block->block_size;
+        left->right_block = block->right_block;
+        sfa_shared_block *next = __sfa_shared_block_at(region, block->right_block);
+        if (next != NULL) next->left_block = block->left_block;
+        offset = block->left_block;
+        block = left;
+
+    }
+
+    __sfa_shared_free_list_insert(region, block, offset);
+
+}
+
+static inline sfa_shared_heap*
+__sfa_shared_heap_attach(int file, uint64_t size, bool create)
+{
+
+    if (file < 0) return NULL;
+
+    sfa_shared_heap *heap = (sfa_shared_heap*)sf_alloc(sizeof(sfa_shared_heap));
+    sfa_shared_region *region = (heap != NULL) ?
+        (sfa_shared_region*)__sfa_shared_memory_map(file, &size, create) : NULL;
+    bool is_valid = (region != NULL);
+
+    // Created regions start out as a single free block spanning everything past the
+    // region descriptor. Opened regions must be one of ours, and whole.
+    if (is_valid && create)
+    {
+
+        uint64_t first_offset = __sfa_shared_region_size();
+        sfa_shared_block *first = __sfa_shared_block_at(region, first_offset);
+        first->block_size   = size - first_offset - __sfa_shared_block_size();
+        first->is_occupied  = false;
+        first->left_block   = 0;
+        first->right_block  = 0;
+
+        region->region_size = size;
+        region->free_list = 0;
+        region->root = 0;
+        __sfa_shared_free_list_insert(region, first, first_offset);
+        is_valid = __sfa_shared_lock_init(&region->lock);
+        region->magic = SFA_SHARED_HEAP_MAGIC;
+
+    }
+
+    else if (is_valid)
+    {
+        is_valid = size >= __sfa_shared_region_size() &&
+            region->magic == SFA_SHARED_HEAP_MAGIC && region->region_size == size;
+    }
+
+    if (is_valid == false)
+    {
+        __sfa_shared_memory_close(file, region, size);
+        sf_free(heap);
+        return NULL;
+    }
+
+    heap->region = region;
+    heap->region_size = size;
+    heap->file = file;
+    return heap;
+
+}
+
+static inline uint64_t
+__sfa_shared_heap_region_size(uint64_t size)
+{
+
+    uint64_t page_size = __sfa_virtual_size();
+    return (size + __sfa_shared_region_size() + __sfa_shared_block_size() +
+            page_size - 1) & ~(page_size - 1);
+
+}
+
+sfa_shared_heap*
+sf_shared_heap_create(const char *name, uint64_t size)
+{
+
+    if (size > SFA_ALLOCATION_MAXIMUM_SIZE) return NULL;
+    int file = __sfa_shared_memory_open(name, true);
+    sfa_shared_heap *heap = __sfa_shared_heap_attach(file, __sfa_shared_heap_region_size(size), true);
+    if (heap == NULL && file >= 0 && name != NULL) __sfa_shared_memory_unlink(name);
+    return heap;
+
+}
+
+sfa_shared_heap*
+sf_shared_heap_create_file(const char *path, uint64_t size)
+{
+
+    // The file is sized sparsely, disk space is only taken as pages are written.
+    SFA_ASSERT_POINTER(path);
+    if (size > SFA_ALLOCATION_MAXIMUM_SIZE) return NULL;
+    int file = __sfa_shared_file_open(path, true);
+    sfa_shared_heap *heap = __sfa_shared_heap_attach(file, __sfa_shared_heap_region_size(size), true);
+    if (heap == NULL && file >= 0) __sfa_shared_file_remove(path);
+    return heap;
+
+}
+
+sfa_shared_heap*
+sf_shared_heap_open(const char *name)
+{
+
+    SFA_ASSERT_POINTER(name);
+    return __sfa_shared_heap_attach(__sfa_shared_memory_open(name, false), 0, false);
+
+}
+
+sfa_shared_heap*
+sf_shared_heap_open_file(const char *path)
+{
+
+    // NOTE(Chris): The image may have been saved, or left behind by a crash, with its
+    //              lock held. Nobody else can have it open, so the lock starts over.
+    SFA_ASSERT_POINTER(path);
+    sfa_shared_heap *heap = __sfa_shared_heap_attach(__sfa_shared_file_open(path, false), 0, false);
+    if (heap != NULL && __sfa_shared_lock_init(&heap->region->lock) == false)
+    {
+        sf_shared_heap_close(heap);
+        return NULL;
+    }
+
+    return heap;
+
+}
+
+sfa_shared_heap*
+sf_shared_heap_open_fd(int file)
+{
+
+    return __sfa_shared_heap_attach(file, 0, false);
+
+}
+
+int
+sf_shared_heap_fd(sfa_shared_heap *heap)
+{
+
+    SFA_ASSERT_POINTER(heap);
+    return heap->file;
+
+}
+
+void
+sf_shared_heap_close(sfa_shared_heap *heap)
+{
+
+    // Only this process' mapping goes away, the region lives on until every process
+    // has closed it and its name is unlinked.
+    if (heap == NULL) return;
+    __sfa_shared_memory_close(heap->file, heap->region, heap->region_size);
+    sf_free(heap);
+
+}
+
+bool
+sf_shared_heap_unlink(const char *name)
+{
+
+    SFA_ASSERT_POINTER(name);
+    return __sfa_shared_memory_unlink(name);
+
+}
+
+void*
+sf_shared_heap_alloc(sfa_shared_heap *heap, uint64_t size)
+{
+
+    SFA_ASSERT_POINTER(heap);
+    if (size > SFA_ALLOCATION_MAXIMUM_SIZE) return NULL;
 
-    // Size to the minimum size if required.
     uint64_t required_size = __sfa_request_size_to_minimum_alloc_size(size);
     uint64_t nearest_boundary = __sfa_request_size_to_nearest_boundary(required_size);
 
-    // Select the pool and then accomodate.
-    sfa_pool_search search_results = {0};
-    __sfa_find_pool_for_alloc_fast(nearest_boundary, &search_results);
-    SFA_ASSERT_POINTER(search_results.pool);
-    SFA_ASSERT_POINTER(search_results.list_node);
+    sfa_shared_region *region = heap->region;
+    __sfa_shared_lock_acquire(&region->lock);
+    void *user_ptr = __sfa_shared_alloc_block(region, nearest_boundary);
+    __sfa_lock_release(&region->lock);
+    return user_ptr;
 
-    void* user_ptr = __sfa_accomodate_allocation(nearest_boundary, &search_results);
-    SFA_ASSERT_POINTER(user_ptr);
+}
 
-    return user_ptr;
+void
+sf_shared_heap_free(sfa_shared_heap *heap, void *ptr)
+{
+
+    SFA_ASSERT_POINTER(heap);
+    if (ptr == NULL) return;
+
+    sfa_shared_region *region = heap->region;
+    sfa_shared_block *block = (sfa_shared_block*)((uint8_t*)ptr - __sfa_shared_block_size());
+    SFA_ASSERT((uint8_t*)block > (uint8_t*)region && (uint8_t*)ptr < (uint8_t*)region + heap->region_size);
+    SFA_ASSERT(block->is_occupied);
+
+    __sfa_shared_lock_acquire(&region->lock);
+    __sfa_shared_free_block(region, block);
+    __sfa_lock_release(&region->lock);
 
 }
 
-void    
-sf_free(void *ptr)
+uint64_t
+sf_shared_heap_offset(sfa_shared_heap *heap, void *ptr)
+{
+
+    SFA_ASSERT_POINTER(heap);
+    if (ptr == NULL) return 0;
+    SFA_ASSERT((uint8_t*)ptr > (uint8_t*)heap->region && (uint8_t*)ptr < (uint8_t*)heap->region + heap->region_size);
+    return (uint64_t)((uint8_t*)ptr - (uint8_t*)heap->region);
+
+}
+
+void*
+sf_shared_heap_pointer(sfa_shared_heap *heap, uint64_t offset)
+{
+
+    SFA_ASSERT_POINTER(heap);
+    if (offset == 0) return NULL;
+    SFA_ASSERT(offset < heap->region_size);
+    return (uint8_t*)heap->region + offset;
+
+}
+
+bool
+sf_shared_heap_save(sfa_shared_heap *heap)
+{
+
+    // Holding the lock keeps the free list consistent on disk, the contents of the
+    // blocks are only as consistent as the program leaves them.
+    SFA_ASSERT_POINTER(heap);
+    sfa_shared_region *region = heap->region;
+    __sfa_shared_lock_acquire(&region->lock);
+    bool is_saved = __sfa_shared_memory_sync(region, heap->region_size);
+    __sfa_lock_release(&region->lock);
+    return is_saved;
+
+}
+
+void
+sf_shared_heap_set_root(sfa_shared_heap *heap, void *ptr)
 {
 
+    uint64_t offset = sf_shared_heap_offset(heap, ptr);
+    sfa_shared_region *region = heap->region;
+    __sfa_shared_lock_acquire(&region->lock);
+    region->root = offset;
+    __sfa_lock_release(&region->lock);
+
+}
+
+void*
+sf_shared_heap_root(sfa_shared_heap *heap)
+{
 
+    SFA_ASSERT_POINTER(heap);
+    sfa_shared_region *region = heap->region;
+    __sfa_shared_lock_acquire(&region->lock);
+    uint64_t offset = region->root;
+    __sfa_lock_release(&region->lock);
+    return sf_shared_heap_pointer(heap, offset);
 
 }
 
@@ -0,0 +1,883 @@
+// --- SF Allocator C++ Adapters -----------------------------------------------
+//
+// Written by Chris DeJong, GitHub @ magictrickdev
+//
+//      C++ adapters for SF allocator. Include this header after (or instead of)
+//      sfallocator.h, the implementation is still emitted by defining
+//      SFA_IMPLEMENTATION in exactly one C or C++ source file.
+//
+//      sfa::memory_resource is a std::pmr::memory_resource backed by a heap, and
+//      sfa::allocator<T> is a standard allocator for containers. Both forward the
+//      requested alignment so over-aligned types take the aligned path.
+//
+//          sfa::memory_resource resource(SFA_MEGABYTES(64));
+//          std::pmr::vector<int> values(&resource);
+//
+//          sfa::allocator<node> node_allocator(resource.heap());
+//          std::list<node, sfa::allocator<node>> nodes(node_allocator);
+//
+//      For fixed sizes known at compile time, sfa::alloc_fixed<N>() and
+//      sfa::free_fixed<N>(ptr) resolve the size class (and whether the thread cache
+//      applies at all) during compilation, sfa::object_pool<T> wraps them per-type.
+//
+//      Coroutine promise types may derive from sfa::coroutine_frame_allocator so
+//      their frames are recycled through a per-thread frame cache:
+//
+//          struct promise_type : sfa::coroutine_frame_allocator { ... };
+//
+//      sfa::vector<T> is a growable array built on sfa_buffer, which uses all of
+//      the usable capacity of its block and grows in place whenever it can.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef SFALLOCATOR_HPP
+#define SFALLOCATOR_HPP
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <memory_resource>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "sfallocator.h"
+
+namespace sfa
+{
+
+    // --- Memory Resource -----------------------------------------------------
+    //
+    // Owns a dedicated heap when constructed with a reservation size, otherwise
+    // refers to an existing heap (NULL being the default heap). Destroying an owning
+    // resource releases the entire heap, the same as std::pmr::monotonic_buffer_resource
+    // would release its buffers.
+    //
+
+    class memory_resource : public std::pmr::memory_resource
+    {
+
+        public:
+            explicit        memory_resource(uint64_t reserve_size);
+            explicit        memory_resource(sfa_heap *heap = NULL) noexcept;
+            virtual        ~memory_resource();
+
+                            memory_resource(const memory_resource&) = delete;
+            memory_resource& operator=(const memory_resource&) = delete;
+
+            sfa_heap*       heap() const noexcept { return this->heap_; }
+
+        protected:
+            virtual void*   do_allocate(std::size_t bytes, std::size_t alignment) override;
+            virtual void    do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override;
+            virtual bool    do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+        protected:
+            sfa_heap   *heap_;
+            bool        owns_heap_;
+
+    };
+
+    inline
+    memory_resource::memory_resource(uint64_t reserve_size)
+        : heap_(sf_heap_create(reserve_size)), owns_heap_(true)
+    {
+
+        if (this->heap_ == NULL) throw std::bad_alloc();
+
+    }
+
+    inline
+    memory_resource::memory_resource(sfa_heap *heap) noexcept
+        : heap_(heap), owns_heap_(false)
+    {
+
+    }
+
+    inline
+    memory_resource::~memory_resource()
+    {
+
+        if (this->owns_heap_) sf_heap_destroy(this->heap_);
+
+    }
+
+    inline void*
+    memory_resource::do_allocate(std::size_t bytes, std::size_t alignment)
+    {
+
+        void *ptr = sf_heap_alloc_aligned(this->heap_, bytes, alignment);
+        if (ptr == NULL) throw std::bad_alloc();
+        return ptr;
+
+    }
+
+    inline void
+    memory_resource::do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment)
+    {
+
+        // Only the default heap has a thread cache which can make use of the size.
+        (void)alignment;
+        if (this->heap_ == NULL) sf_free_sized(ptr, bytes);
+        else sf_free(ptr);
+
+    }
+
+    inline bool
+    memory_resource::do_is_equal(const std::pmr::memory_resource &other) const noexcept
+    {
+
+        // Any two resources on the same heap can free each other's memory.
+        const memory_resource *other_resource = dynamic_cast<const memory_resource*>(&other);
+        return other_resource != NULL && other_resource->heap_ == this->heap_;
+
+    }
+
+    // --- Allocator -----------------------------------------------------------
+    //
+    // A standard allocator bound to a heap. Default constructed allocators use the
+    // default heap, allocators compare equal when they share a heap.
+    //
+
+    template <class T>
+    class allocator
+    {
+
+        public:
+            using value_type                                = T;
+            using propagate_on_container_copy_assignment    = std::true_type;
+            using propagate_on_container_move_assignment    = std::true_type;
+            using propagate_on_container_swap               = std::true_type;
+            using is_always_equal                           = std::false_type;
+
+        public:
+                            allocator() noexcept : heap_(NULL) { }
+            explicit        allocator(sfa_heap *heap) noexcept : heap_(heap) { }
+            template <class U>
+                            allocator(const allocator<U> &other) noexcept : heap_(other.heap()) { }
+
+            T*              allocate(std::size_t count);
+            void            deallocate(T *ptr, std::size_t count) noexcept;
+#if defined (__cpp_lib_allocate_at_least)
+            std::allocation_result<T*>
+                            allocate_at_least(std::size_t count);
+#endif
+
+            sfa_heap*       heap() const noexcept { return this->heap_; }
+
+        protected:
+            sfa_heap *heap_;
+
+    };
+
+    template <class T> inline T*
+    allocator<T>::allocate(std::size_t count)
+    {
+
+        if (count > SFA_ALLOCATION_MAXIMUM_SIZE / sizeof(T)) throw std::bad_array_new_length();
+
+        void *ptr = sf_heap_alloc_aligned(this->heap_, count * sizeof(T), alignof(T));
+        if (ptr == NULL) throw std::bad_alloc();
+        return static_cast<T*>(ptr);
+
+    }
+
+    template <class T> inline void
+    allocator<T>::deallocate(T *ptr, std::size_t count) noexcept
+    {
+
+        if (this->heap_ == NULL) sf_free_sized(ptr, count * sizeof(T));
+        else sf_free(ptr);
+
+    }
+
+#if defined (__cpp_lib_allocate_at_least)
+    template <class T> inline std::allocation_result<T*>
+    allocator<T>::allocate_at_least(std::size_t count)
+    {
+
+        // Containers which ask for it are handed all of the block's usable space.
+        T *ptr = this->allocate(count);
+        return { ptr, static_cast<std::size_t>(sf_usable_size(ptr) / sizeof(T)) };
+
+    }
+#endif
+
+    template <class T, class U> inline bool
+    operator==(const allocator<T> &lhs, const allocator<U> &rhs) noexcept
+    {
+
+        return lhs.heap() == rhs.heap();
+
+    }
+
+    template <class T, class U> inline bool
+    operator!=(const allocator<T> &lhs, const allocator<U> &rhs) noexcept
+    {
+
+        return lhs.heap() != rhs.heap();
+
+    }
+
+    // --- Fixed Size Allocations ----------------------------------------------
+    //
+    // The size class table mirrors the thread cache of the default heap. Sizes that
+    // fit a class compile down to a thread cache pop or push of a constant class
+    // index, everything else is forwarded to the regular entry points.
+    //
+
+    constexpr std::size_t size_class_count = SFA_THREAD_CACHE_CLASS_COUNT;
+
+    constexpr std::array<std::size_t, size_class_count>
+    make_size_class_table() noexcept
+    {
+
+        std::array<std::size_t, size_class_count> table = {};
+        for (std::size_t index = 0; index < size_class_count; ++index)
+            table[index] = SFA_SIZE_CLASS_SIZE(index);
+        return table;
+
+    }
+
+    constexpr std::array<std::size_t, size_class_count> size_class_table = make_size_class_table();
+
+    template <std::size_t N>
+    constexpr std::size_t size_class_of = SFA_SIZE_CLASS_OF(N);
+
+    template <std::size_t N, std::size_t Alignment = alignof(std::max_align_t)>
+    constexpr bool is_size_class_cached =
+        N <= SFA_THREAD_CACHE_MAXIMUM_SIZE && Alignment <= SFA_ALLOCATION_ALIGNMENT_SIZE;
+
+    static_assert(size_class_table[size_class_of<1>] >= 1);
+    static_assert(size_class_table[size_class_of<SFA_THREAD_CACHE_MAXIMUM_SIZE>] ==
+            SFA_THREAD_CACHE_MAXIMUM_SIZE);
+
+    template <std::size_t N, std::size_t Alignment = alignof(std::max_align_t)> inline void*
+    alloc_fixed() noexcept
+    {
+
+        static_assert(N > 0, "Fixed allocations must have a non-zero size.");
+        if constexpr (is_size_class_cached<N, Alignment>)
+            return sf_alloc_class(size_class_of<N>);
+        else
+            return sf_alloc_aligned(N, Alignment);
+
+    }
+
+    template <std::size_t N, std::size_t Alignment = alignof(std::max_align_t)> inline void
+    free_fixed(void *ptr) noexcept
+    {
+
+        if constexpr (is_size_class_cached<N, Alignment>)
+            sf_free_class(ptr, size_class_of<N>);
+        else
+            sf_free_sized(ptr, N);
+
+    }
+
+    // --- Object Pool ---------------------------------------------------------
+    //
+    // A stateless pool of T on the default heap, every member resolves to the
+    // fixed size entry points for sizeof(T) and alignof(T).
+    //
+
+    template <class T>
+    class object_pool
+    {
+
+        public:
+            static constexpr std::size_t object_size        = sizeof(T);
+            static constexpr std::size_t object_alignment   = alignof(T);
+
+        public:
+            T*              allocate();
+            void            deallocate(T *ptr) noexcept;
+
+            template <class... Args>
+            T*              create(Args&&... args);
+            void            destroy(T *ptr) noexcept;
+
+    };
+
+    template <class T> inline T*
+    object_pool<T>::allocate()
+    {
+
+        void *ptr = alloc_fixed<object_size, object_alignment>();
+        if (ptr == NULL) throw std::bad_alloc();
+        return static_cast<T*>(ptr);
+
+    }
+
+    template <class T> inline void
+    object_pool<T>::deallocate(T *ptr) noexcept
+    {
+
+        free_fixed<object_size, object_alignment>(ptr);
+
+    }
+
+    template <class T> template <class... Args> inline T*
+    object_pool<T>::create(Args&&... args)
+    {
+
+        T *ptr = this->allocate();
+        try { return ::new (static_cast<void*>(ptr)) T(std::forward<Args>(args)...); }
+        catch (...) { this->deallocate(ptr); throw; }
+
+    }
+
+    template <class T> inline void
+    object_pool<T>::destroy(T *ptr) noexcept
+    {
+
+        if (ptr == NULL) return;
+        ptr->~T();
+        this->deallocate(ptr);
+
+    }
+
+    // --- Coroutine Frames ----------------------------------------------------
+    //
+    // Coroutine frames of a given coroutine always have the same size, so frames are
+    // recycled through per-thread bins keyed by frame size. Frames which fit the
+    // thread cache size classes are binned per class, larger frames at a coarser
+    // granularity up to the maximum frame size, and anything larger is a regular
+    // allocation. Hitting a bin is an inlined pop or push on thread local state, the
+    // heap is only involved on a miss. The bins are returned to the heap when their
+    // thread exits.
+    //
+
+    class coroutine_frame_cache
+    {
+
+        public:
+            static constexpr std::size_t    granularity         = 256;
+            static constexpr std::size_t    maximum_size        = SFA_KILOBYTES(16);
+            static constexpr std::size_t    class_bin_count     = SFA_THREAD_CACHE_CLASS_COUNT;
+            static constexpr std::size_t    bin_count           = class_bin_count +
+                (maximum_size - SFA_THREAD_CACHE_MAXIMUM_SIZE) / granularity;
+            static constexpr std::uint32_t  depth               = 16;
+
+        public:
+            static inline void*     allocate(std::size_t size);
+            static inline void      deallocate(void *ptr, std::size_t size) noexcept;
+
+        protected:
+            // NOTE(Chris): Constant-initialized and trivially destructible, so accessing
+            //              it needs no thread local guard. A bin takes frames while it
+            //              has capacity left, which is only handed out once the release
+            //              guard is registered and taken away again when it runs.
+            struct bin_state
+            {
+                void           *bins[bin_count];
+                std::uint32_t   capacity[bin_count];
+                bool            is_registered;
+                bool            is_released;
+            };
+
+            struct release_guard
+            {
+                ~release_guard() noexcept;
+            };
+
+            static inline thread_local bin_state state = {};
+
+            static constexpr std::size_t    bin_index(std::size_t size) noexcept;
+            static constexpr std::size_t    bin_size(std::size_t index) noexcept;
+            static void                     register_release() noexcept;
+            static void*                    allocate_slow(std::size_t index, std::size_t size);
+            static void                     deallocate_slow(void *ptr, std::size_t index) noexcept;
+
+    };
+
+    constexpr std::size_t
+    coroutine_frame_cache::bin_index(std::size_t size) noexcept
+    {
+
+        if (size <= SFA_THREAD_CACHE_MAXIMUM_SIZE) return SFA_SIZE_CLASS_OF(size);
+        return class_bin_count + (size - SFA_THREAD_CACHE_MAXIMUM_SIZE - 1) / granularity;
+
+    }
+
+    constexpr std::size_t
+    coroutine_frame_cache::bin_size(std::size_t index) noexcept
+    {
+
+        if (index < class_bin_count) return SFA_SIZE_CLASS_SIZE(index);
+        return SFA_THREAD_CACHE_MAXIMUM_SIZE + (index - class_bin_count + 1) * granularity;
+
+    }
+
+    inline
+    coroutine_frame_cache::release_guard::~release_guard() noexcept
+    {
+
+        state.is_released = true;
+        for (std::size_t index = 0; index < bin_count; ++index)
+        {
+
+            while (state.bins[index] != NULL)
+            {
+                void *ptr = state.bins[index];
+                state.bins[index] = *static_cast<void**>(ptr);
+                sf_free(ptr);
+            }
+
+            state.capacity[index] = 0;
+
+        }
+
+    }
+
+    inline void
+    coroutine_frame_cache::register_release() noexcept
+    {
+
+        static thread_local release_guard guard;
+        (void)guard;
+
+        state.is_registered = true;
+        for (std::size_t index = 0; index < bin_count; ++index) state.capacity[index] = depth;
+
+    }
+
+    inline void*
+    coroutine_frame_cache::allocate_slow(std::size_t index, std::size_t size)
+    {
+
+        if (state.is_registered == false && state.is_released == false) register_release();
+
+        void *ptr = NULL;
+        if (index < class_bin_count) ptr = sf_alloc_class(index);
+        else if (index < bin_count) ptr = sf_alloc(bin_size(index));
+        else ptr = sf_alloc(size);
+
+        if (ptr == NULL) throw std::bad_alloc();
+        return ptr;
+
+    }
+
+    inline void
+    coroutine_frame_cache::deallocate_slow(void *ptr, std::size_t index) noexcept
+    {
+
+        if (state.is_registered == false && state.is_released == false) register_release();
+        if (index < bin_count && state.capacity[index] > 0)
+        {
+            *static_cast<void**>(ptr) = state.bins[index];
+            state.bins[index] = ptr;
+            state.capacity[index] -= 1;
+            return;
+        }
+
+        if (index < class_bin_count) sf_free_class(ptr, index);
+        else sf_free(ptr);
+
+    }
+
+    inline void*
+    coroutine_frame_cache::allocate(std::size_t size)
+    {
+
+        std::size_t index = bin_index(size);
+        if (index < bin_count && state.bins[index] != NULL)
+        {
+            void *ptr = state.bins[index];
+            state.bins[index] = *static_cast<void**>(ptr);
+            state.capacity[index] += 1;
+            return ptr;
+        }
+
+        return allocate_slow(index, size);
+
+    }
+
+    inline void
+    coroutine_frame_cache::deallocate(void *ptr, std::size_t size) noexcept
+    {
+
+        std::size_t index = bin_index(size);
+        if (index < bin_count && state.capacity[index] > 0)
+        {
+            *static_cast<void**>(ptr) = state.bins[index];
+            state.bins[index] = ptr;
+            state.capacity[index] -= 1;
+            return;
+        }
+
+        deallocate_slow(ptr, index);
+
+    }
+
+    // Mixin for coroutine promise types, the frame size is handed back on destruction
+    // so the frame goes straight back into its bin.
+    struct coroutine_frame_allocator
+    {
+
+        static void*
+        operator new(std::size_t size)
+        {
+
+            return coroutine_frame_cache::allocate(size);
+
+        }
+
+        static void
+        operator delete(void *ptr, std::size_t size) noexcept
+        {
+
+            coroutine_frame_cache::deallocate(ptr, size);
+
+        }
+
+    };
+
+    // --- Vector --------------------------------------------------------------
+    //
+    // A growable array on a heap. Growth first attempts to expand the block in place,
+    // only when that fails are the elements moved into a new block. Trivially copyable
+    // elements leave the move to sf_buffer_reserve entirely.
+    //
+
+    template <class T>
+    class vector
+    {
+
+        static_assert(alignof(T) <= SFA_ALLOCATION_ALIGNMENT_SIZE,
+                "sfa::vector does not support over-aligned element types.");
+
+        public:
+            using value_type        = T;
+            using size_type         = std::size_t;
+            using reference         = T&;
+            using const_reference   = const T&;
+            using pointer           = T*;
+            using const_pointer     = const T*;
+            using iterator          = T*;
+            using const_iterator    = const T*;
+
+        public:
+                            vector() noexcept;
+            explicit        vector(sfa_heap *heap) noexcept;
+                            vector(std::initializer_list<T> values, sfa_heap *heap = NULL);
+                            vector(const vector &other);
+                            vector(vector &&other) noexcept;
+                           ~vector();
+
+            vector&         operator=(const vector &other);
+            vector&         operator=(vector &&other) noexcept;
+
+            T&              operator[](size_type index) noexcept { return this->data()[index]; }
+            const T&        operator[](size_type index) const noexcept { return this->data()[index]; }
+            T&              at(size_type index);
+            const T&        at(size_type index) const;
+            T&              front() noexcept { return this->data()[0]; }
+            const T&        front() const noexcept { return this->data()[0]; }
+            T&              back() noexcept { return this->data()[this->size() - 1]; }
+            const T&        back() const noexcept { return this->data()[this->size() - 1]; }
+
+            T*              data() noexcept { return static_cast<T*>(this->buffer_.data); }
+            const T*        data() const noexcept { return static_cast<const T*>(this->buffer_.data); }
+            iterator        begin() noexcept { return this->data(); }
+            iterator        end() noexcept { return this->data() + this->size(); }
+            const_iterator  begin() const noexcept { return this->data(); }
+            const_iterator  end() const noexcept { return this->data() + this->size(); }
+
+            bool            empty() const noexcept { return this->buffer_.size == 0; }
+            size_type       size() const noexcept { return this->buffer_.size / sizeof(T); }
+            size_type       capacity() const noexcept { return this->buffer_.capacity / sizeof(T); }
+            sfa_heap*       heap() const noexcept { return this->buffer_.heap; }
+
+            void            reserve(size_type count);
+            void            shrink_to_fit();
+            void            resize(size_type count);
+            void            resize(size_type count, const T &value);
+            void            clear() noexcept;
+
+            void            push_back(const T &value) { this->emplace_back(value); }
+            void            push_back(T &&value) { this->emplace_back(std::move(value)); }
+            template <class... Args>
+            T&              emplace_back(Args&&... args);
+            void            pop_back() noexcept;
+
+        protected:
+            void            grow_to(size_type count);
+            void            relocate_to(size_type count);
+            void            destroy_range(T *first, T *last) noexcept;
+
+        protected:
+            sfa_buffer buffer_;
+
+    };
+
+    template <class T> inline
+    vector<T>::vector() noexcept
+        : buffer_()
+    {
+
+    }
+
+    template <class T> inline
+    vector<T>::vector(sfa_heap *heap) noexcept
+        : buffer_()
+    {
+
+        this->buffer_.heap = heap;
+
+    }
+
+    template <class T> inline
+    vector<T>::vector(std::initializer_list<T> values, sfa_heap *heap)
+        : buffer_()
+    {
+
+        this->buffer_.heap = heap;
+        this->reserve(values.size());
+        for (const T &value : values) this->emplace_back(value);
+
+    }
+
+    template <class T> inline
+    vector<T>::vector(const vector &other)
+        : buffer_()
+    {
+
+        this->buffer_.heap = other.buffer_.heap;
+        this->reserve(other.size());
+        for (const T &value : other) this->emplace_back(value);
+
+    }
+
+    template <class T> inline
+    vector<T>::vector(vector &&other) noexcept
+        : buffer_(other.buffer_)
+    {
+
+        other.buffer_.data = NULL;
+        other.buffer_.size = 0;
+        other.buffer_.capacity = 0;
+
+    }
+
+    template <class T> inline
+    vector<T>::~vector()
+    {
+
+        this->clear();
+        sf_buffer_release(&this->buffer_);
+
+    }
+
+    template <class T> inline vector<T>&
+    vector<T>::operator=(const vector &other)
+    {
+
+        if (this != &other)
+        {
+            this->clear();
+            this->reserve(other.size());
+            for (const T &value : other) this->emplace_back(value);
+        }
+
+        return *this;
+
+    }
+
+    template <class T> inline vector<T>&
+    vector<T>::operator=(vector &&other) noexcept
+    {
+
+        if (this != &other)
+        {
+            this->clear();
+            sf_buffer_release(&this->buffer_);
+            this->buffer_ = other.buffer_;
+            other.buffer_.data = NULL;
+            other.buffer_.size = 0;
+            other.buffer_.capacity = 0;
+        }
+
+        return *this;
+
+    }
+
+    template <class T> inline T&
+    vector<T>::at(size_type index)
+    {
+
+        if (index >= this->size()) throw std::out_of_range("sfa::vector index out of range.");
+        return this->data()[index];
+
+    }
+
+    template <class T> inline const T&
+    vector<T>::at(size_type index) const
+    {
+
+        if (index >= this->size()) throw std::out_of_range("sfa::vector index out of range.");
+        return this->data()[index];
+
+    }
+
+    template <class T> inline void
+    vector<T>::reserve(size_type count)
+    {
+
+        if (count <= this->capacity()) return;
+        if (count > SFA_ALLOCATION_MAXIMUM_SIZE / sizeof(T)) throw std::length_error("sfa::vector is too large.");
+        if (sf_buffer_try_grow(&this->buffer_, count * sizeof(T))) return;
+        this->relocate_to(count);
+
+    }
+
+    template <class T> inline void
+    vector<T>::shrink_to_fit()
+    {
+
+        // Trims the block in place, the elements never move.
+        sf_buffer_shrink_to_fit(&this->buffer_);
+
+    }
+
+    template <class T> inline void
+    vector<T>::resize(size_type count)
+    {
+
+        if (count < this->size())
+        {
+            this->destroy_range(this->data() + count, this->end());
+            this->buffer_.size = count * sizeof(T);
+        }
+
+        else
+        {
+            this->reserve(count);
+            while (this->size() < count) this->emplace_back();
+        }
+
+    }
+
+    template <class T> inline void
+    vector<T>::resize(size_type count, const T &value)
+    {
+
+        if (count < this->size())
+        {
+            this->destroy_range(this->data() + count, this->end());
+            this->buffer_.size = count * sizeof(T);
+        }
+
+        else
+        {
+            this->reserve(count);
+            while (this->size() < count) this->emplace_back(value);
+        }
+
+    }
+
+    template <class T> inline void
+    vector<T>::clear() noexcept
+    {
+
+        this->destroy_range(this->begin(), this->end());
+        this->buffer_.size = 0;
+
+    }
+
+    template <class T> template <class... Args> inline T&
+    vector<T>::emplace_back(Args&&... args)
+    {
+
+        if (this->size() == this->capacity()) this->grow_to(this->size() + 1);
+
+        T *slot = this->data() + this->size();
+        ::new (static_cast<void*>(slot)) T(std::forward<Args>(args)...);
+        this->buffer_.size += sizeof(T);
+        return *slot;
+
+    }
+
+    template <class T> inline void
+    vector<T>::pop_back() noexcept
+    {
+
+        this->back().~T();
+        this->buffer_.size -= sizeof(T);
+
+    }
+
+    template <class T> inline void
+    vector<T>::grow_to(size_type count)
+    {
+
+        // Geometric growth, but take exactly what is needed if that fits in place.
+        size_type grown_count = this->capacity() + (this->capacity() / 2);
+        if (grown_count < count) grown_count = count;
+        if (grown_count > SFA_ALLOCATION_MAXIMUM_SIZE / sizeof(T)) throw std::length_error("sfa::vector is too large.");
+
+        if (sf_buffer_try_grow(&this->buffer_, grown_count * sizeof(T))) return;
+        if (sf_buffer_try_grow(&this->buffer_, count * sizeof(T))) return;
+        this->relocate_to(grown_count);
+
+    }
+
+    template <class T> inline void
+    vector<T>::relocate_to(size_type count)
+    {
+
+        if constexpr (std::is_trivially_copyable_v<T>)
+        {
+            if (sf_buffer_reserve(&this->buffer_, count * sizeof(T)) == false) throw std::bad_alloc();
+        }
+
+        else
+        {
+
+            sfa_buffer relocated = {};
+            relocated.heap = this->buffer_.heap;
+            if (sf_buffer_reserve(&relocated, count * sizeof(T)) == false) throw std::bad_alloc();
+
+            // The sources are only destroyed once every element made it across, so a
+            // throwing copy leaves the vector exactly as it was.
+            T *source = this->data();
+            T *destination = static_cast<T*>(relocated.data);
+            size_type element_count = this->size();
+            size_type constructed_count = 0;
+            try
+            {
+                for (; constructed_count < element_count; ++constructed_count)
+                {
+                    ::new (static_cast<void*>(destination + constructed_count))
+                        T(std::move_if_noexcept(source[constructed_count]));
+                }
+            }
+
+            catch (...)
+            {
+                this->destroy_range(destination, destination + constructed_count);
+                sf_buffer_release(&relocated);
+                throw;
+            }
+
+            this->destroy_range(source, source + element_count);
+            relocated.size = this->buffer_.size;
+            sf_buffer_release(&this->buffer_);
+            this->buffer_ = relocated;
+
+        }
+
+    }
+
+    template <class T> inline void
+    vector<T>::destroy_range(T *first, T *last) noexcept
+    {
+
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            for (; first != last; ++first) first->~T();
+
+    }
+
+}
+
+#endif
@@ -0,0 +1,224 @@
+// --- SF Allocator Global Operator New/Delete ---------------------------------
+//
+// Written by Chris DeJong, GitHub @ magictrickdev
+//
+//      Opt-in replacement of every global operator new and delete with SF allocator.
+//      Add this file to your build to enable it, the implementation itself must
+//      still be emitted by defining SFA_IMPLEMENTATION in one other source file.
+//
+//      Sized deletes are routed to sf_free_sized, which bins small blocks into the
+//      thread cache by the given size without reading the allocation's own size.
+//      GCC enables sized deallocation by default from C++14 onward, Clang prior to
+//      version 19 requires -fsized-deallocation.
+//
+// -----------------------------------------------------------------------------
+
+#include <cstddef>
+#include <new>
+#include "sfallocator.h"
+
+static inline void*
+__sfa_operator_new(std::size_t size)
+{
+
+    // Standard behavior: invoke the new-handler until it either frees up enough
+    // memory or throws, and throw bad_alloc if there is no handler.
+    for (;;)
+    {
+
+        void *ptr = sf_alloc(size);
+        if (ptr != NULL) return ptr;
+
+        std::new_handler handler = std::get_new_handler();
+        if (handler == NULL) throw std::bad_alloc();
+        handler();
+
+    }
+
+}
+
+static inline void*
+__sfa_operator_new_aligned(std::size_t size, std::align_val_t alignment)
+{
+
+    for (;;)
+    {
+
+        void *ptr = sf_alloc_aligned(size, static_cast<uint64_t>(alignment));
+        if (ptr != NULL) return ptr;
+
+        std::new_handler handler = std::get_new_handler();
+        if (handler == NULL) throw std::bad_alloc();
+        handler();
+
+    }
+
+}
+
+// --- Allocation --------------------------------------------------------------
+
+void*
+operator new(std::size_t size)
+{
+
+    return __sfa_operator_new(size);
+
+}
+
+void*
+operator new[](std::size_t size)
+{
+
+    return __sfa_operator_new(size);
+
+}
+
+void*
+operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+
+    try { return __sfa_operator_new(size); }
+    catch (...) { return NULL; }
+
+}
+
+void*
+operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+
+    try { return __sfa_operator_new(size); }
+    catch (...) { return NULL; }
+
+}
+
+void*
+operator new(std::size_t size, std::align_val_t alignment)
+{
+
+    return __sfa_operator_new_aligned(size, alignment);
+
+}
+
+void*
+operator new[](std::size_t size, std::align_val_t alignment)
+{
+
+    return __sfa_operator_new_aligned(size, alignment);
+
+}
+
+void*
+operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+
+    try { return __sfa_operator_new_aligned(size, alignment); }
+    catch (...) { return NULL; }
+
+}
+
+void*
+operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+
+    try { return __sfa_operator_new_aligned(size, alignment); }
+    catch (...) { return NULL; }
+
+}
+
+// --- Deallocation ------------------------------------------------------------
+
+void
+operator delete(void *ptr) noexcept
+{
+
+    sf_free(ptr);
+
+}
+
+void
+operator delete[](void *ptr) noexcept
+{
+
+    sf_free(ptr);
+
+}
+
+void
+operator delete(void *ptr, std::size_t size) noexcept
+{
+
+    sf_free_sized(ptr, size);
+
+}
+
+void
+operator delete[](void *ptr, std::size_t size) noexcept
+{
+
+    sf_free_sized(ptr, size);
+
+}
+
+void
+operator delete(void *ptr, const std::nothrow_t&) noexcept
+{
+
+    sf_free(ptr);
+
+}
+
+void
+operator delete[](void *ptr, const std::nothrow_t&) noexcept
+{
+
+    sf_free(ptr);
+
+}
+
+void
+operator delete(void *ptr, std::align_val_t) noexcept
+{
+
+    sf_free(ptr);
+
+}
+
+void
+operator delete[](void *ptr, std::align_val_t) noexcept
+{
+
+    sf_free(ptr);
+
+}
+
+void
+operator delete(void *ptr, std::size_t size, std::align_val_t) noexcept
+{
+
+    sf_free_sized(ptr, size);
+
+}
+
+void
+operator delete[](void *ptr, std::size_t size, std::align_val_t) noexcept
+{
+
+    sf_free_sized(ptr, size);
+
+}
+
+void
+operator delete(void *ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+
+    sf_free(ptr);
+
+}
+
+void
+operator delete[](void *ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+
+    sf_free(ptr);
+
+}